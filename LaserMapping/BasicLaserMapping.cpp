@@ -1,9 +1,12 @@
 #include "BasicLaserMapping.h"
+#include "MapFile.h"
 #include "nanoflann_pcl.h"
 #include "math_utils.h"
 
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
+#include <algorithm>
+#include <chrono>
 
 namespace loam
 {
@@ -24,52 +27,40 @@ BasicLaserMapping::BasicLaserMapping(const float& scanPeriod, const size_t& maxI
    _maxIterations(maxIterations),
    _deltaTAbort(0.05),
    _deltaRAbort(0.05),
-   _laserCloudCenWidth(10), // 搜索邻域宽度, cm为单位
-   _laserCloudCenHeight(5), // 搜索邻域高度, cm为单位
-   _laserCloudCenDepth(10), // 搜索邻域深度, cm为单位
-   _laserCloudWidth(21), // 子cube沿宽方向的分割个数，每个子cube 50mm =1m/20
-   _laserCloudHeight(11), // 高方向个数 50mm
-   _laserCloudDepth(21), // 深度方向个数 50mm
-   _laserCloudNum(_laserCloudWidth * _laserCloudHeight * _laserCloudDepth), // 子cube总数
-   _laserCloudCornerLast(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudSurfLast(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudFullRes(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudCornerStack(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudSurfStack(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudCornerStackDS(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudSurfStackDS(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudSurround(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudSurroundDS(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudCornerFromMap(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudSurfFromMap(new pcl::PointCloud<pcl::PointXYZI>())
+   _cubeMap(200), // 子cube边长, m为单位
+   _searchRadius(400), // 搜索邻域半径, m为单位
+   _prefetchHorizon(10), // 预读轨迹时长, s为单位
+   _localizationMode(false),
+   _mapTreesCurrent(false),
+   _mapCenter(),
+   _laserCloudCornerLast(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudSurfLast(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudFullRes(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudCornerStack(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudSurfStack(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudCornerStackDS(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudSurfStackDS(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudCubeDS(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudSurround(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudSurroundDS(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudCornerFromMap(new pcl::PointCloud<PointXYZIRT>()),
+   _laserCloudSurfFromMap(new pcl::PointCloud<PointXYZIRT>()),
+   _downSizeFilter(0.2f, VoxelHashFilter<PointXYZIRT>::FIRST_POINT),
+   _downSizeFilterMap(1.0, VoxelHashFilter<PointXYZIRT>::FIRST_POINT, 4)
 {
    // initialize frame counter
    _frameCount = _stackFrameNum - 1;
    _mapFrameCount = _mapFrameNum - 1;
 
-   // setup cloud vectors
-   _laserCloudCornerArray.resize(_laserCloudNum);
-   _laserCloudSurfArray.resize(_laserCloudNum);
-   _laserCloudCornerDSArray.resize(_laserCloudNum);
-   _laserCloudSurfDSArray.resize(_laserCloudNum);
-
-   for (size_t i = 0; i < _laserCloudNum; i++)
-   {
-      _laserCloudCornerArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-      _laserCloudSurfArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-      _laserCloudCornerDSArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-      _laserCloudSurfDSArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-   }
-
    // setup down size filters
 //   _downSizeFilterCorner.setLeafSize(0.2, 0.2, 0.2);
 //   _downSizeFilterSurf.setLeafSize(0.4, 0.4, 0.4);
 }
 
 
-void BasicLaserMapping::pointAssociateToMap(const pcl::PointXYZI& pi, pcl::PointXYZI& po)
+void BasicLaserMapping::pointAssociateToMap(const PointXYZIRT& pi, PointXYZIRT& po)
 {
-   pcl::PointXYZI newPoint = pi;
+   PointXYZIRT newPoint = pi;
 
 //   rotateZXY(newPoint, cur_state.yaw, cur_state.roll, cur_state.pitch);
 //   rotateZXY(newPoint, cur_state.roll, cur_state.pitch, cur_state.yaw);
@@ -93,27 +84,20 @@ bool BasicLaserMapping::createDownsizedMap()
 
    // accumulate map cloud
    _laserCloudSurround->clear();
-   for (auto ind : _laserCloudSurroundInd)
+   for (auto const& key : _laserCloudSurroundInd)
    {
-      *_laserCloudSurround += *_laserCloudCornerArray[ind];
-      *_laserCloudSurround += *_laserCloudSurfArray[ind];
+      if (const CubeMap::Cube* cube = mapCube(key, false))
+      {
+         *_laserCloudSurround += *cube->corner;
+         *_laserCloudSurround += *cube->surf;
+      }
    }
 
    // down size map cloud
-   _laserCloudSurroundDS->clear();
-   DownsizePointCloud(*_laserCloudSurround, *_laserCloudSurroundDS, 1.0); // 降采样
+   _downSizeFilterMap.filter(*_laserCloudSurround, *_laserCloudSurroundDS); // 降采样
    return true;
 }
 
-Eigen::Affine3f BasicLaserMapping::NAVDATA2Transform(const NAVDATA &nav) {
-   Eigen::Affine3f transform_ = Eigen::Affine3f::Identity();
-   transform_.translation() << nav.x, nav.y, nav.z;
-   transform_.rotate(Eigen::AngleAxisf (nav.roll, Eigen::Vector3f::UnitX()));
-   transform_.rotate(Eigen::AngleAxisf (nav.pitch, Eigen::Vector3f::UnitY()));
-   transform_.rotate(Eigen::AngleAxisf (nav.yaw, Eigen::Vector3f::UnitZ()));
-   return transform_;
-}
-
 void BasicLaserMapping::interpolate(const vector<NAVDATA>& data,
                                          const long long& time,
                                          NAVDATA& result)
@@ -141,32 +125,25 @@ void BasicLaserMapping::interpolate(const vector<NAVDATA>& data,
 };
 
 
-void BasicLaserMapping::DownsizePointCloud(const pcl::PointCloud<pcl::PointXYZI> & laserCloudIn,
-                                           pcl::PointCloud<pcl::PointXYZI> & laserCloudOut,
+void BasicLaserMapping::DownsizePointCloud(const pcl::PointCloud<PointXYZIRT> & laserCloudIn,
+                                           pcl::PointCloud<PointXYZIRT> & laserCloudOut,
                                            double filter_size) {
-   if(laserCloudIn.points.size() <= 0)
-   {
-      laserCloudOut = laserCloudIn;
-      return;
-   }
-   pcl::UniformSampling<pcl::PointXYZI> filter;
-   filter.setInputCloud(laserCloudIn.makeShared());
-   filter.setRadiusSearch(filter_size);
-   pcl::PointCloud<int> keypointIndices;
-   filter.compute(keypointIndices);
-   pcl::copyPointCloud(laserCloudIn, keypointIndices.points, laserCloudOut);
+   _downSizeFilter.setLeafSize(filter_size);
+   _downSizeFilter.filter(laserCloudIn, laserCloudOut);
 }
 
 
-void BasicLaserMapping::process(const pcl::PointCloud<pcl::PointXYZI>::Ptr laserCloudIn,
-                               const pcl::PointCloud<pcl::PointXYZI>& cornerPointsSharp,
-                               const pcl::PointCloud<pcl::PointXYZI>& surPointsFlat,
+void BasicLaserMapping::process(const pcl::PointCloud<PointXYZIRT>::Ptr laserCloudIn,
+                               const pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+                               const pcl::PointCloud<PointXYZIRT>& surPointsFlat,
                                const long long& scanTime,
                                const std::vector<NAVDATA>& nav,
-                               pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudMap)
+                               pcl::PointCloud<PointXYZIRT>::Ptr& laserCloudMap)
 {
+   _solverBudget.start();
+
 #if false
-   pcl::PointCloud<pcl::PointXYZI>::Ptr laserCloudInDS(new pcl::PointCloud<pcl::PointXYZI>);
+   pcl::PointCloud<PointXYZIRT>::Ptr laserCloudInDS(new pcl::PointCloud<PointXYZIRT>);
    DownsizePointCloud(*laserCloudIn, *laserCloudInDS, 3.f);
 
    std::cout << "laserCloudInNum -> " << laserCloudIn->points.size() << std::endl;
@@ -181,11 +158,11 @@ void BasicLaserMapping::process(const pcl::PointCloud<pcl::PointXYZI>::Ptr laser
 
    cur_state = nav[cur_index];
 
-   pcl::PointXYZI pointSel_;
+   PointXYZIRT pointSel_;
 
-   pcl::PointCloud<pcl::PointXYZI> laserCloudInDSStack;
+   pcl::PointCloud<PointXYZIRT> laserCloudInDSStack;
 
-   pcl::transformPointCloud(*laserCloudInDS, *laserCloudInDS, NAVDATA2Transform(cur_state));
+   Pose::fromNav(cur_state).transformCloud(*laserCloudInDS, *laserCloudInDS);
 
    for (auto const& pt : laserCloudInDS->points)
    {
@@ -202,341 +179,384 @@ void BasicLaserMapping::process(const pcl::PointCloud<pcl::PointXYZI>::Ptr laser
    }
    _frameCount = 0;
 
-   pcl::PointXYZI pointSel;
+   PointXYZIRT pointSel;
 
    interpolate(nav, scanTime, _transformSum); /* 使用imu位姿信息初始化_transform */
 
-   for(auto const& pt : cornerPointsSharp.points)
-   {
-      pointSel = pcl::transformPoint(pt,NAVDATA2Transform(_transform));
-      _laserCloudCornerStack->push_back(pointSel);
-   }
-
-   for(auto const& pt : surPointsFlat.points)
-   {
-      pointSel = pcl::transformPoint(pt,NAVDATA2Transform(_transform));
-      _laserCloudSurfStack->push_back(pointSel);
-   }
+   const Pose transform = Pose::fromNav(_transform);
+   transform.appendTransformed(cornerPointsSharp, *_laserCloudCornerStack);
+   transform.appendTransformed(surPointsFlat, *_laserCloudSurfStack);
 
-   pcl::PointXYZI pointOnZAxis;
+   PointXYZIRT pointOnZAxis;
    pointOnZAxis.x = 0.0;
    pointOnZAxis.y = 0.0;
    pointOnZAxis.z = 10.0;
-   pointOnZAxis = pcl::transformPoint(pointOnZAxis, NAVDATA2Transform(_transform));
+   pointOnZAxis = transform.transformPoint(pointOnZAxis);
+
+   const float cubeSize = _cubeMap.getCubeSize();
+   _cubeMap.beginFrame();
+
+   /* 接收后台预读完成的cube */
+   if (_tileStore)
+   {
+      _tileCubes.clear();
+      _tileStore->collect(_tileCubes);
+      for (auto& entry : _tileCubes)
+      {
+         _cubeMap.insert(entry.first, std::move(entry.second));
+      }
+   }
 
-   auto const CUBE_SIZE = 200.0;
-   auto const CUBE_HALF = CUBE_SIZE / 2;
+   /* 计算中心点(当前位置)所在的地图cube, cube按需分配, 地图没有边界 */
+   const CubeKey centerCube = _cubeMap.keyOf(_transformSum.x, _transformSum.y, _transformSum.z);
 
-   /* 计算中心点(当前位置)在地图超立方体中的索引 */
-   int centerCubeI = int((_transformSum.x + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenWidth;
-   int centerCubeJ = int((_transformSum.y + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenHeight;
-   int centerCubeK = int((_transformSum.z + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenDepth;
+   std::cout << "centerCubeI = " << centerCube.i << ", centerCubeJ = " << centerCube.j << ", centerCubeK = " << centerCube.k << std::endl;
 
-   if (_transformSum.x + CUBE_HALF < 0) centerCubeI--;
-   if (_transformSum.y + CUBE_HALF < 0) centerCubeJ--;
-   if (_transformSum.z + CUBE_HALF < 0) centerCubeK--;
+   /* 在中心块周围搜索半径内的cube中找对应点 */
+   const int cubeRange = std::max(1, int(std::ceil(_searchRadius / cubeSize)));
+   selectMapCubes(centerCube, cubeRange, pointOnZAxis);
 
-   std::cout << "centerCubeI = " << centerCubeI << ", centerCubeJ = " << centerCubeJ << ", centerCubeK = " << centerCubeK << std::endl;
+   std::cout << "_laserCloudValidInd's size = " << _laserCloudValidInd.size() << std::endl;
+   std::cout << "_laserCloudSurroundInd = " << _laserCloudSurroundInd.size() << std::endl;
 
-   while (centerCubeI < 3)
+   /* 从地图中选择特征点用于位姿优化, 未分配的cube没有点. 定位模式下地图不变, 中心cube不变时沿用上一帧的特征点及KD树.
+      沿用的特征点是快照: cube的换出及预读照常进行, 其间读入或换出的cube在中心cube改变后才反映出来 */
+   if (!_localizationMode || !_mapTreesCurrent || centerCube != _mapCenter)
    {
-      for (int j = 0; j < _laserCloudHeight; j++)
+      _laserCloudCornerFromMap->clear();
+      _laserCloudSurfFromMap->clear();
+      for (auto const& key : _laserCloudValidInd)
       {
-         for (int k = 0; k < _laserCloudDepth; k++)
+         if (const CubeMap::Cube* cube = mapCube(key, false))
          {
-            for (int i = _laserCloudWidth - 1; i >= 1; i--)
-            {
-               const size_t indexA = toIndex(i, j, k);
-               const size_t indexB = toIndex(i - 1, j, k);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
-            }
+            *_laserCloudCornerFromMap += *cube->corner;
+            *_laserCloudSurfFromMap += *cube->surf;
          }
       }
-      centerCubeI++;
-      _laserCloudCenWidth++;
+      _mapCenter = centerCube;
+      _mapTreesCurrent = false;
    }
 
-   while (centerCubeI >= _laserCloudWidth - 3)
+   std::cout << "__laserCloudCornerFromMap's size = " << _laserCloudCornerFromMap->points.size() << std::endl;
+   std::cout << "_laserCloudSurfFromMap's size = " << _laserCloudSurfFromMap->points.size() << std::endl;
+
+   // prepare feature stack clouds for pose optimization
+//   Pose::fromNav(_transformSum).transformCloud(*_laserCloudCornerStack, *_laserCloudCornerStack);
+//   Pose::fromNav(_transformSum).transformCloud(*_laserCloudSurfStack, *_laserCloudSurfStack);
+
+   // down sample feature stack clouds
+   _laserCloudCornerStackDS->clear();
+   DownsizePointCloud(*_laserCloudCornerStack, *_laserCloudCornerStackDS, 3.0); // TODO: 降采样
+//   pcl::copyPointCloud(*_laserCloudCornerStackDS, *_laserCloudCornerStack);
+
+   size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->size();
+
+   _laserCloudSurfStackDS->clear();
+   DownsizePointCloud(*_laserCloudSurfStack, *_laserCloudSurfStackDS, 3.0); // TODO: 降采样
+//   pcl::copyPointCloud(*_laserCloudSurfStackDS, *_laserCloudSurfStack);
+
+   size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->size();
+
+   _laserCloudCornerStack->clear();
+   _laserCloudSurfStack->clear();
+
+   std::cout << "_laserCloudCornerStackDS's size = " << _laserCloudCornerStackDS->points.size() << std::endl;
+   std::cout << "_laserCloudSurfStackDS's size = " << _laserCloudSurfStackDS->points.size() << std::endl;
+
+   optimizeTransformTobeMapped();
+   const Pose transformSum = Pose::fromNav(_transformSum);
+
+   std::cout << "transformSum2 -> " << _transformSum.x << ", " << _transformSum.y << ", " << _transformSum.z << ", " << _transformSum.roll << ", " << _transformSum.pitch << ", " << _transformSum.yaw << std::endl;
+
+   /* 定位模式下地图冻结, 不插入新点也不维护地图 */
+   if (!_localizationMode)
    {
-      for (int j = 0; j < _laserCloudHeight; j++)
+      // store down sized corner stack points in corresponding cube clouds
+      for (int i = 0; i < laserCloudCornerStackNum; i++)
       {
-         for (int k = 0; k < _laserCloudDepth; k++)
-         {
-            for (int i = 0; i < _laserCloudWidth - 1; i++)
-            {
-               const size_t indexA = toIndex(i, j, k);
-               const size_t indexB = toIndex(i + 1, j, k);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
-            }
-         }
+         pointSel = transformSum.transformPoint(_laserCloudCornerStackDS->points[i]); // 坐标变换
+
+         /* 求pointSel所对应的cube */
+         mapCube(_cubeMap.keyOf(pointSel.x, pointSel.y, pointSel.z), true)->corner->push_back(pointSel);
       }
-      centerCubeI--;
-      _laserCloudCenWidth--;
-   }
 
-   while (centerCubeJ < 3)
-   {
-      for (int i = 0; i < _laserCloudWidth; i++)
+      // store down sized surface stack points in corresponding cube clouds
+      for (int i = 0; i < laserCloudSurfStackNum; i++)
       {
-         for (int k = 0; k < _laserCloudDepth; k++)
-         {
-            for (int j = _laserCloudHeight - 1; j >= 1; j--)
-            {
-               const size_t indexA = toIndex(i, j, k);
-               const size_t indexB = toIndex(i, j - 1, k);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
-            }
-         }
+         pointSel = transformSum.transformPoint(_laserCloudSurfStackDS->points[i]); // 坐标变换
+
+         mapCube(_cubeMap.keyOf(pointSel.x, pointSel.y, pointSel.z), true)->surf->push_back(pointSel);
       }
-      centerCubeJ++;
-      _laserCloudCenHeight++;
-   }
 
-   while (centerCubeJ >= _laserCloudHeight - 3)
-   {
-      for (int i = 0; i < _laserCloudWidth; i++)
+      /* 插入的点可能新分配了搜索半径内的cube */
+      selectMapCubes(centerCube, cubeRange, pointOnZAxis);
+
+//       down size all valid (within field of view) feature cube clouds
+      size_t before = 0, after = 0;
+      int cnt = 0;
+      for (auto const& key : _laserCloudValidInd)
       {
-         for (int k = 0; k < _laserCloudDepth; k++)
+         CubeMap::Cube* cube = mapCube(key, false);
+         if (!cube)
          {
-            for (int j = 0; j < _laserCloudHeight - 1; j++)
-            {
-               const size_t indexA = toIndex(i, j, k);
-               const size_t indexB = toIndex(i, j + 1, k);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
-            }
+            continue;
          }
+
+         cnt++;
+         before += cube->corner->size();
+         _laserCloudCubeDS->clear();
+         DownsizePointCloud(*cube->corner, *_laserCloudCubeDS, 0.1); // TODO: 降采样
+         cube->corner.swap(_laserCloudCubeDS);
+
+         _laserCloudCubeDS->clear();
+         DownsizePointCloud(*cube->surf, *_laserCloudCubeDS, 0.1); // TODO: 降采样
+         cube->surf.swap(_laserCloudCubeDS);
+         after += cube->corner->size();
       }
-      centerCubeJ--;
-      _laserCloudCenHeight--;
+      std::cout << "counter: before = " << before << ", " << "after = " << after << ", cnt = " << cnt << std::endl;
    }
 
-   while (centerCubeK < 3)
+   /* 超出cube数上限时释放最久未使用的cube, 有瓦片存储时写入磁盘, 并按导航轨迹预读前方的cube */
+   _tileCubes.clear();
+   size_t evicted = _cubeMap.evict(_tileStore ? &_tileCubes : NULL);
+#ifdef LOAM_PRINT_STATS
+   std::cout << "map cubes -> " << _cubeMap.size() << ", evicted -> " << evicted << std::endl;
+#else
+   (void)evicted;
+#endif
+   if (_tileStore)
    {
-      for (int i = 0; i < _laserCloudWidth; i++)
+      for (auto& entry : _tileCubes)
       {
-         for (int j = 0; j < _laserCloudHeight; j++)
-         {
-            for (int k = _laserCloudDepth - 1; k >= 1; k--)
-            {
-               const size_t indexA = toIndex(i, j, k);
-               const size_t indexB = toIndex(i, j, k - 1);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
-            }
-         }
+         _tileStore->spill(entry.first, entry.second);
       }
-      centerCubeK++;
-      _laserCloudCenDepth++;
+      prefetchAlongTrajectory(nav, scanTime);
+
+#ifdef LOAM_PRINT_STATS
+      const CubeTileStore::Statistics& stats = _tileStore->getStatistics();
+      std::cout << "tiles on disk -> " << _tileStore->size() << ", spilled -> " << stats.spilled
+                << ", prefetched -> " << stats.prefetched << ", blocking loads -> " << stats.blockingLoads << std::endl;
+#endif
    }
 
-   while (centerCubeK >= _laserCloudDepth - 3)
+   if (!_localizationMode)
    {
-      for (int i = 0; i < _laserCloudWidth; i++)
-      {
-         for (int j = 0; j < _laserCloudHeight; j++)
-         {
-            for (int k = 0; k < _laserCloudDepth - 1; k++)
-            {
-               const size_t indexA = toIndex(i, j, k);
-               const size_t indexB = toIndex(i, j, k + 1);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
-            }
-         }
-      }
-      centerCubeK--;
-      _laserCloudCenDepth--;
+      _downsizedMapCreated = createDownsizedMap();
    }
+   laserCloudMap = _laserCloudSurroundDS;
+
+   std::cout << "_laserCloudSurroundDS's size = " << _laserCloudSurroundDS->points.size() << std::endl;
+}
+
 
-   /* 在中心块周围5*5*5的范围内找对应点 */
+void BasicLaserMapping::selectMapCubes(const CubeKey& center, const int& range, const PointXYZIRT& pointOnZAxis)
+{
+   const float cubeSize = _cubeMap.getCubeSize();
+   const float cubeHalf = cubeSize / 2;
+
+   /* 只取已分配(内存中或磁盘上)的cube, 未分配的cube没有点, 不必逐个判断 */
    _laserCloudValidInd.clear();
    _laserCloudSurroundInd.clear();
-   for (int i = centerCubeI - 2; i <= centerCubeI + 2; i++)
+   _cubeMap.forEachInRange(center, range, [this](const CubeKey& key, const CubeMap::Cube&)
+   {
+      _laserCloudSurroundInd.push_back(key);
+   });
+   if (_tileStore)
    {
-      for (int j = centerCubeJ - 2; j <= centerCubeJ + 2; j++)
+      _tileStore->forEachInRange(center, range, [this](const CubeKey& key)
       {
-         for (int k = centerCubeK - 2; k <= centerCubeK + 2; k++)
+         _laserCloudSurroundInd.push_back(key);
+      });
+   }
+   /* 按坐标排序, 地图点的顺序与cube是否已写入磁盘无关 */
+   std::sort(_laserCloudSurroundInd.begin(), _laserCloudSurroundInd.end(), [](const CubeKey& a, const CubeKey& b)
+   {
+      return a.i != b.i ? a.i < b.i : (a.j != b.j ? a.j < b.j : a.k < b.k);
+   });
+
+   PointXYZIRT transform_pos; // 坐标变换 值为当前车辆位置
+   transform_pos.x = _transformSum.x;
+   transform_pos.y = _transformSum.y;
+   transform_pos.z = _transformSum.z;
+
+   for (const CubeKey& cubeKey : _laserCloudSurroundInd)
+   {
+      float centerX = cubeSize * cubeKey.i;
+      float centerY = cubeSize * cubeKey.j;
+      float centerZ = cubeSize * cubeKey.k;
+
+      /* 计算当前点是否在视野内 */
+      bool isInLaserFOV = false;
+      for (int ii = -1; ii <= 1; ii += 2)
+      {
+         for (int jj = -1; jj <= 1; jj += 2)
          {
-            if (i >= 0 && i < _laserCloudWidth &&
-                j >= 0 && j < _laserCloudHeight &&
-                k >= 0 && k < _laserCloudDepth)
+            for (int kk = -1; kk <= 1; kk += 2)
             {
+               PointXYZIRT corner;
+               corner.x = centerX + cubeHalf * ii;
+               corner.y = centerY + cubeHalf * jj;
+               corner.z = centerZ + cubeHalf * kk;
 
-               float centerX = 200.0f * (i - _laserCloudCenWidth);
-               float centerY = 200.0f * (j - _laserCloudCenHeight);
-               float centerZ = 200.0f * (k - _laserCloudCenDepth);
+               float squaredSide1 = calcSquaredDiff(transform_pos, corner);
+               float squaredSide2 = calcSquaredDiff(pointOnZAxis, corner);
 
-               pcl::PointXYZI transform_pos; // 坐标变换 值为当前车辆位置
-               transform_pos.x = _transformSum.x;
-               transform_pos.y = _transformSum.y;
-               transform_pos.z = _transformSum.z;
+               float check1 = 100.0f + squaredSide1 - squaredSide2
+                  - 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
 
-               /* 计算当前点是否在视野内 */
-               bool isInLaserFOV = false;
-               for (int ii = -1; ii <= 1; ii += 2)
-               {
-                  for (int jj = -1; jj <= 1; jj += 2)
-                  {
-                     for (int kk = -1; kk <= 1; kk += 2)
-                     {
-                        pcl::PointXYZI corner;
-                        corner.x = centerX + 100.0f * ii;
-                        corner.y = centerY + 100.0f * jj;
-                        corner.z = centerZ + 100.0f * kk;
-
-                        float squaredSide1 = calcSquaredDiff(transform_pos, corner);
-                        float squaredSide2 = calcSquaredDiff(pointOnZAxis, corner);
-
-                        float check1 = 100.0f + squaredSide1 - squaredSide2
-                           - 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
-
-                        float check2 = 100.0f + squaredSide1 - squaredSide2
-                           + 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
-
-//                        std::cout << "check 1 = " << check1 << ", check 2 = " << check2 << std::endl;
-
-                        if (check1 < 0 && check2 > 0)
-                        {
-                           isInLaserFOV = true;
-                        }
-                     }
-                  }
-               }
+               float check2 = 100.0f + squaredSide1 - squaredSide2
+                  + 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
 
-               size_t cubeIdx = i + _laserCloudWidth * j + _laserCloudWidth * _laserCloudHeight * k;
-               if (true/*isInLaserFOV*/) //TODO: 要不要把視角判定加進來
+//               std::cout << "check 1 = " << check1 << ", check 2 = " << check2 << std::endl;
+
+               if (check1 < 0 && check2 > 0)
                {
-                  _laserCloudValidInd.push_back(cubeIdx);
+                  isInLaserFOV = true;
                }
-               _laserCloudSurroundInd.push_back(cubeIdx);
             }
          }
       }
-   }
 
-   std::cout << "_laserCloudValidInd's size = " << _laserCloudValidInd.size() << std::endl;
-   std::cout << "_laserCloudSurroundInd = " << _laserCloudSurroundInd.size() << std::endl;
+      if (true/*isInLaserFOV*/) //TODO: 要不要把視角判定加進來
+      {
+         _laserCloudValidInd.push_back(cubeKey);
+      }
+   }
+}
 
-   /* 从地图中选择特征点用于位姿优化 */
-   _laserCloudCornerFromMap->clear();
-   _laserCloudSurfFromMap->clear();
-   for (auto const& ind : _laserCloudValidInd)
+CubeMap::Cube* BasicLaserMapping::mapCube(const CubeKey& key, const bool& create)
+{
+   if (CubeMap::Cube* cube = _cubeMap.find(key))
    {
-      *_laserCloudCornerFromMap += *_laserCloudCornerArray[ind];
-      *_laserCloudSurfFromMap += *_laserCloudSurfArray[ind];
+      return cube;
    }
 
-   std::cout << "__laserCloudCornerFromMap's size = " << _laserCloudCornerFromMap->points.size() << std::endl;
-   std::cout << "_laserCloudSurfFromMap's size = " << _laserCloudSurfFromMap->points.size() << std::endl;
-
-   // prepare feature stack clouds for pose optimization
-//   pcl::transformPointCloud(*_laserCloudCornerStack, *_laserCloudCornerStack, NAVDATA2Transform(_transformSum));
-//   pcl::transformPointCloud(*_laserCloudSurfStack, *_laserCloudSurfStack, NAVDATA2Transform(_transformSum));
-
-   // down sample feature stack clouds
-   _laserCloudCornerStackDS->clear();
-   DownsizePointCloud(*_laserCloudCornerStack, *_laserCloudCornerStackDS, 3.0); // TODO: 降采样
-//   pcl::copyPointCloud(*_laserCloudCornerStackDS, *_laserCloudCornerStack);
-
-   size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->size();
-
-   _laserCloudSurfStackDS->clear();
-   DownsizePointCloud(*_laserCloudSurfStack, *_laserCloudSurfStackDS, 3.0); // TODO: 降采样
-//   pcl::copyPointCloud(*_laserCloudSurfStackDS, *_laserCloudSurfStack);
-
-   size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->size();
-
-   _laserCloudCornerStack->clear();
-   _laserCloudSurfStack->clear();
-
-   std::cout << "_laserCloudCornerStackDS's size = " << _laserCloudCornerStackDS->points.size() << std::endl;
-   std::cout << "_laserCloudSurfStackDS's size = " << _laserCloudSurfStackDS->points.size() << std::endl;
-
-   optimizeTransformTobeMapped();
-
-   std::cout << "transformSum2 -> " << _transformSum.x << ", " << _transformSum.y << ", " << _transformSum.z << ", " << _transformSum.roll << ", " << _transformSum.pitch << ", " << _transformSum.yaw << std::endl;
-
-   // store down sized corner stack points in corresponding cube clouds
-   for (int i = 0; i < laserCloudCornerStackNum; i++)
+   /* 已写入磁盘的cube先读回, 否则新分配的cube会覆盖磁盘上的数据 */
+   if (_tileStore && _tileStore->contains(key))
    {
-      pointSel = pcl::transformPoint(_laserCloudCornerStackDS->points[i], NAVDATA2Transform(_transformSum)); // 坐标变换
-
-      /* 求pointSel所对应的index */
-      int cubeI = int((pointSel.x + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenWidth;
-      int cubeJ = int((pointSel.y + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenHeight;
-      int cubeK = int((pointSel.z + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenDepth;
+      CubeMap::Cube cube;
+      _tileStore->take(key, cube);
+      return &_cubeMap.insert(key, std::move(cube));
+   }
 
-      if (pointSel.x + CUBE_HALF < 0) cubeI--;
-      if (pointSel.y + CUBE_HALF < 0) cubeJ--;
-      if (pointSel.z + CUBE_HALF < 0) cubeK--;
+   return create ? &_cubeMap.cube(key) : NULL;
+}
 
-      if (cubeI >= 0 && cubeI < _laserCloudWidth &&
-          cubeJ >= 0 && cubeJ < _laserCloudHeight &&
-          cubeK >= 0 && cubeK < _laserCloudDepth)
+void BasicLaserMapping::prefetchAlongTrajectory(const std::vector<NAVDATA>& nav, const long long& scanTime)
+{
+   const float cubeSize = _cubeMap.getCubeSize();
+   const float step = cubeSize / 2;
+   const int cubeRange = std::max(1, int(std::ceil(_searchRadius / cubeSize)));
+   const long long endTime = scanTime + (long long)(_prefetchHorizon * 1000);
+
+   /* 收集前方轨迹上间隔半个cube的位置 */
+   std::vector<Eigen::Vector3f> positions;
+   Eigen::Vector3f last(_transformSum.x, _transformSum.y, _transformSum.z);
+   size_t pos = 0;
+   while (pos < nav.size() && nav[pos].millisec <= scanTime)
+   {
+      pos++;
+   }
+   for (; pos < nav.size() && nav[pos].millisec <= endTime; pos++)
+   {
+      const Eigen::Vector3f p(nav[pos].x, nav[pos].y, nav[pos].z);
+      if ((p - last).norm() >= step)
       {
-         size_t cubeInd = cubeI + _laserCloudWidth * cubeJ + _laserCloudWidth * _laserCloudHeight * cubeK;
-         _laserCloudCornerArray[cubeInd]->push_back(pointSel);
+         positions.push_back(p);
+         last = p;
       }
    }
 
-   // store down sized surface stack points in corresponding cube clouds
-   for (int i = 0; i < laserCloudSurfStackNum; i++)
+   /* 导航数据不足预读时长时, 按最后两个位姿的速度外推 */
+   if (pos == nav.size() && nav.size() >= 2)
    {
-      pointSel = pcl::transformPoint(_laserCloudSurfStackDS->points[i], NAVDATA2Transform(_transformSum)); // 坐标变换
-
-      int cubeI = int((pointSel.x + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenWidth;
-      int cubeJ = int((pointSel.y + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenHeight;
-      int cubeK = int((pointSel.z + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenDepth;
-
-      if (pointSel.x + CUBE_HALF < 0) cubeI--;
-      if (pointSel.y + CUBE_HALF < 0) cubeJ--;
-      if (pointSel.z + CUBE_HALF < 0) cubeK--;
-
-      if (cubeI >= 0 && cubeI < _laserCloudWidth &&
-          cubeJ >= 0 && cubeJ < _laserCloudHeight &&
-          cubeK >= 0 && cubeK < _laserCloudDepth)
+      const NAVDATA& a = nav[nav.size() - 2];
+      const NAVDATA& b = nav.back();
+      const float dt = (b.millisec - a.millisec) / 1000.0f;
+      const float remaining = (endTime - std::max(scanTime, b.millisec)) / 1000.0f;
+      if (dt > 0 && remaining > 0)
       {
-         size_t cubeInd = cubeI + _laserCloudWidth * cubeJ + _laserCloudWidth * _laserCloudHeight * cubeK;
-         _laserCloudSurfArray[cubeInd]->push_back(pointSel);
+         const Eigen::Vector3f velocity = Eigen::Vector3f(b.x - a.x, b.y - a.y, b.z - a.z) / dt;
+         const float distance = velocity.norm() * remaining;
+         const Eigen::Vector3f start(b.x, b.y, b.z);
+         for (float d = step; d <= distance; d += step)
+         {
+            positions.push_back(start + velocity.normalized() * d);
+         }
       }
    }
 
-//    down size all valid (within field of view) feature cube clouds
-   size_t before = 0, after = 0;
-   int cnt = 0;
-   for (auto const& ind : _laserCloudValidInd)
+   /* 只预读磁盘上的cube, 内存中的cube不在瓦片存储中 */
+   for (const Eigen::Vector3f& p : positions)
+   {
+      const CubeKey center = _cubeMap.keyOf(p.x(), p.y(), p.z());
+      _tileStore->forEachInRange(center, cubeRange, [this](const CubeKey& key)
+      {
+         _tileStore->prefetch(key);
+      });
+   }
+}
+
+bool BasicLaserMapping::saveMap(const std::string& path)
+{
+   /* 已写入瓦片存储的cube逐个从磁盘读出写入地图文件, 不读回内存中的地图 */
+   std::vector<CubeKey> tileKeys;
+   if (_tileStore)
    {
-      cnt++;
-      before += _laserCloudCornerArray[ind]->size();
-      _laserCloudCornerDSArray[ind]->clear();
-      DownsizePointCloud(*_laserCloudCornerArray[ind], *_laserCloudCornerDSArray[ind], 0.1); // TODO: 降采样
-//      pcl::copyPointCloud(*_laserCloudCornerArray[ind], *_laserCloudCornerDSArray[ind]);
-
-      _laserCloudSurfDSArray[ind]->clear();
-      DownsizePointCloud(*_laserCloudSurfArray[ind], *_laserCloudSurfDSArray[ind], 0.1); // TODO: 降采样
-//      pcl::copyPointCloud(*_laserCloudCornerArray[ind], *_laserCloudCornerDSArray[ind]);
-
-      // swap cube clouds for next processing
-      _laserCloudCornerArray[ind].swap(_laserCloudCornerDSArray[ind]);
-      _laserCloudSurfArray[ind].swap(_laserCloudSurfDSArray[ind]);
-      after += _laserCloudCornerArray[ind]->size();
+      tileKeys = _tileStore->keys();
    }
-   std::cout << "counter: before = " << before << ", " << "after = " << after << ", cnt = " << cnt << std::endl;
 
-   _downsizedMapCreated = createDownsizedMap();
-   laserCloudMap = _laserCloudSurroundDS;
+   if (!saveMapFile(path, _cubeMap, *_laserCloudSurroundDS, tileKeys,
+                    [this](const CubeKey& key, CubeMap::Cube& cube) { return _tileStore->read(key, cube); }))
+   {
+      return false;
+   }
+   std::cout << "map saved -> " << path << ", cubes -> " << _cubeMap.size() + tileKeys.size() << std::endl;
+   return true;
+}
 
-   std::cout << "_laserCloudSurroundDS's size = " << _laserCloudSurroundDS->points.size() << std::endl;
+bool BasicLaserMapping::loadMap(const std::string& path)
+{
+   auto loadStart = std::chrono::steady_clock::now();
+   if (!loadMapFile(path, _cubeMap, *_laserCloudSurroundDS))
+   {
+      return false;
+   }
+   _downsizedMapCreated = true;
+   _mapTreesCurrent = false;
+
+   std::cout << "map loaded -> " << path << ", cubes -> " << _cubeMap.size() << ", load time -> "
+             << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count()
+             << " ms" << std::endl;
+   return true;
 }
 
 
-nanoflann::KdTreeFLANN<pcl::PointXYZI> kdtreeCornerFromMap;
-nanoflann::KdTreeFLANN<pcl::PointXYZI> kdtreeSurfFromMap;
+nanoflann::KdTreeFLANN<PointXYZIRT> kdtreeCornerFromMap;
+nanoflann::KdTreeFLANN<PointXYZIRT> kdtreeSurfFromMap;
+
 
+void BasicLaserMapping::updateJacobian()
+{
+   float srx = sin(_transformSum.roll); // 坐标变换
+   float crx = cos(_transformSum.roll);
+   float sry = sin(_transformSum.pitch);
+   float cry = cos(_transformSum.pitch);
+   float srz = sin(_transformSum.yaw);
+   float crz = cos(_transformSum.yaw);
+
+   _jacobian.dR[0] << crx*sry*srz, crx*crz*sry, -srx*sry,
+                      -srx*srz, -crz*srx, -crx,
+                      crx*cry*srz, crx*cry*crz, -cry*srx;
+   _jacobian.dR[1] << cry*srx*srz - crz*sry, sry*srz + cry*crz*srx, crx*cry,
+                      0, 0, 0,
+                      -cry*crz - srx*sry*srz, cry*srz - crz*srx*sry, -crx*sry;
+   _jacobian.dR[2] << crz*srx*sry - cry*srz, -cry*crz - srx*sry*srz, 0,
+                      crx*crz, -crx*srz, 0,
+                      sry*srz + cry*crz*srx, crz*sry - cry*srx*srz, 0;
+   _jacobian.origin.setZero();
+   _jacobian.dT.setIdentity();
+}
 
 void BasicLaserMapping::optimizeTransformTobeMapped()
 {
@@ -545,13 +565,16 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
       return;
    std::cout << "anchor 2" << std::endl;
 
-   pcl::PointXYZI pointSel, pointOri, coeff;
-
-   std::vector<int> pointSearchInd(5, 0);
-   std::vector<float> pointSearchSqDis(5, 0);
+   PointXYZIRT pointSel, pointOri, coeff;
+   Eigen::Matrix<float, 6, 1> a;
 
-   kdtreeCornerFromMap.setInputCloud(_laserCloudCornerFromMap);
-   kdtreeSurfFromMap.setInputCloud(_laserCloudSurfFromMap);
+   /* 地图特征点更新后才重建KD树 */
+   if (!_mapTreesCurrent)
+   {
+      kdtreeCornerFromMap.setInputCloud(_laserCloudCornerFromMap);
+      kdtreeSurfFromMap.setInputCloud(_laserCloudSurfFromMap);
+      _mapTreesCurrent = true;
+   }
 
    std::cout << "anchor 3" << std::endl;
 
@@ -576,19 +599,31 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
    size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->size();
    size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->size();
 
+   bool converged = false;
+   float deltaR = 0, deltaT = 0;
    for (size_t iterCount = 0; iterCount < _maxIterations; iterCount++)
    {
-      _laserCloudOri.clear();
-      _coeffSel.clear();
+      /* 剩余时间不足以完成下一次迭代时停止, 保留上一次迭代的结果 */
+      if (!_solverBudget.nextIteration())
+         break;
+
+      const Pose transform = Pose::fromNav(_transformSum);
+      NormalEquations equations;
+      updateJacobian();
 
       std::cout << "DYP building constraint with corner feature" << std::endl;
       std::cout << "DYP laserCloudCornerStackNum = " << laserCloudCornerStackNum << std::endl;
 
+      /* 坐标变换后一次批量并行查询所有特征点的5个最近邻 */
+      transform.transformCloud(*_laserCloudCornerStackDS, _laserCloudStackSel);
+      kdtreeCornerFromMap.nearestKSearch(_laserCloudStackSel, 5, _pointSearchInd, _pointSearchSqDis, true);
+
       for (int i = 0; i < laserCloudCornerStackNum; i++)
       {
          pointOri = _laserCloudCornerStackDS->points[i];
-         pointSel = pcl::transformPoint(pointOri, NAVDATA2Transform(_transformSum)); // 坐标变换
-         kdtreeCornerFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+         pointSel = _laserCloudStackSel.points[i];
+         const int* pointSearchInd = &_pointSearchInd[5 * i];
+         const float* pointSearchSqDis = &_pointSearchSqDis[5 * i];
 
          if (pointSearchSqDis[4] < 1.0)
          {
@@ -660,22 +695,26 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
 
                if (s > 0.1)
                {
-                  _laserCloudOri.push_back(pointOri);
-                  _coeffSel.push_back(coeff);
+                  _jacobian.row(pointOri.getVector3fMap(), coeff.getVector3fMap(), a);
+                  equations.add(a, -coeff.intensity);
                }
             }
          }
       }
 
-      std::cout << "DYP selected features = " << _laserCloudOri.size() << std::endl;
+      std::cout << "DYP selected features = " << equations.size() << std::endl;
       std::cout << "DYP building constraint with surface feature" << std::endl;
       std::cout << "DYP laserCloudSurfStackNum = " << laserCloudSurfStackNum << std::endl;
 
+      transform.transformCloud(*_laserCloudSurfStackDS, _laserCloudStackSel);
+      kdtreeSurfFromMap.nearestKSearch(_laserCloudStackSel, 5, _pointSearchInd, _pointSearchSqDis, true);
+
       for (int i = 0; i < laserCloudSurfStackNum; i++)
       {
          pointOri = _laserCloudSurfStackDS->points[i];
-         pointSel = pcl::transformPoint(pointOri, NAVDATA2Transform(_transformSum)); // 坐标变换
-         kdtreeSurfFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+         pointSel = _laserCloudStackSel.points[i];
+         const int* pointSearchInd = &_pointSearchInd[5 * i];
+         const float* pointSearchSqDis = &_pointSearchSqDis[5 * i];
 
          if (pointSearchSqDis[4] < 1.0)
          {
@@ -722,67 +761,23 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
 
                if (s > 0.1)
                {
-                  _laserCloudOri.push_back(pointOri);
-                  _coeffSel.push_back(coeff);
+                  _jacobian.row(pointOri.getVector3fMap(), coeff.getVector3fMap(), a);
+                  equations.add(a, -coeff.intensity);
                }
             }
          }
       }
 
-      std::cout << "DYP selected features = " << _laserCloudOri.size() << std::endl;
+      std::cout << "DYP selected features = " << equations.size() << std::endl;
 
       std::cout << "DYP start optimization" << std::endl;
 
-      float srx = sin(_transformSum.roll); // 坐标变换
-      float crx = cos(_transformSum.roll);
-      float sry = sin(_transformSum.pitch);
-      float cry = cos(_transformSum.pitch);
-      float srz = sin(_transformSum.yaw);
-      float crz = cos(_transformSum.yaw);
-
-      size_t laserCloudSelNum = _laserCloudOri.size();
+      size_t laserCloudSelNum = equations.size();
       if (laserCloudSelNum < 50)
          continue;
 
-      Eigen::Matrix<float, Eigen::Dynamic, 6> matA(laserCloudSelNum, 6);
-      Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, laserCloudSelNum);
-      Eigen::Matrix<float, 6, 6> matAtA;
-      Eigen::VectorXf matB(laserCloudSelNum);
-      Eigen::VectorXf matAtB;
-      Eigen::VectorXf matX;
-
-      for (int i = 0; i < laserCloudSelNum; i++)
-      {
-         std::cout << "anchor 4" << std::endl;
-         pointOri = _laserCloudOri.points[i];
-         coeff = _coeffSel.points[i];
-
-         float arx = (crx*sry*srz*pointOri.x + crx * crz*sry*pointOri.y - srx * sry*pointOri.z) * coeff.x
-            + (-srx * srz*pointOri.x - crz * srx*pointOri.y - crx * pointOri.z) * coeff.y
-            + (crx*cry*srz*pointOri.x + crx * cry*crz*pointOri.y - cry * srx*pointOri.z) * coeff.z;
-
-         float ary = ((cry*srx*srz - crz * sry)*pointOri.x
-                      + (sry*srz + cry * crz*srx)*pointOri.y + crx * cry*pointOri.z) * coeff.x
-            + ((-cry * crz - srx * sry*srz)*pointOri.x
-               + (cry*srz - crz * srx*sry)*pointOri.y - crx * sry*pointOri.z) * coeff.z;
-
-         float arz = ((crz*srx*sry - cry * srz)*pointOri.x + (-cry * crz - srx * sry*srz)*pointOri.y)*coeff.x
-            + (crx*crz*pointOri.x - crx * srz*pointOri.y) * coeff.y
-            + ((sry*srz + cry * crz*srx)*pointOri.x + (crz*sry - cry * srx*srz)*pointOri.y)*coeff.z;
-
-         matA(i, 0) = arx;
-         matA(i, 1) = ary;
-         matA(i, 2) = arz;
-         matA(i, 3) = coeff.x;
-         matA(i, 4) = coeff.y;
-         matA(i, 5) = coeff.z;
-         matB(i, 0) = -coeff.intensity;
-      }
-
-      matAt = matA.transpose();
-      matAtA = matAt * matA;
-      matAtB = matAt * matB;
-      matX = matAtA.colPivHouseholderQr().solve(matAtB);
+      Eigen::Matrix<float, 6, 6> matAtA = equations.AtA();
+      Eigen::Matrix<float, 6, 1> matX = matAtA.colPivHouseholderQr().solve(equations.AtB());
 
       if (iterCount == 0)
       {
@@ -832,17 +827,27 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
 
       std::cout << "DYP finish optimization" << std::endl;
 
-      float deltaR = sqrt(pow(rad2deg(matX(0, 0)), 2) +
-                          pow(rad2deg(matX(1, 0)), 2) +
-                          pow(rad2deg(matX(2, 0)), 2));
-      float deltaT = sqrt(pow(matX(3, 0) * 100, 2) +
-                          pow(matX(4, 0) * 100, 2) +
-                          pow(matX(5, 0) * 100, 2));
+      deltaR = sqrt(pow(rad2deg(matX(0, 0)), 2) +
+                    pow(rad2deg(matX(1, 0)), 2) +
+                    pow(rad2deg(matX(2, 0)), 2));
+      deltaT = sqrt(pow(matX(3, 0) * 100, 2) +
+                    pow(matX(4, 0) * 100, 2) +
+                    pow(matX(5, 0) * 100, 2));
 
       if (deltaR < _deltaRAbort && deltaT < _deltaTAbort)
+      {
+         converged = true;
          break;
+      }
    }
 
+   _solverBudget.finish(converged, deltaR, deltaT);
+#ifdef LOAM_PRINT_STATS
+   std::cout << "DYP solver: ";
+   _solverBudget.print(std::cout);
+   std::cout << std::endl;
+#endif
+
 //   transformUpdate();
 }
 
@@ -1,17 +1,24 @@
 #pragma once
 
+#include "CubeMap.h"
+#include "CubeTileStore.h"
 #include "Twist.h"
 #include "../ScanRegistration/CircularBuffer.h"
+#include "../ScanRegistration/NormalEquations.h"
+#include "../ScanRegistration/PointTypes.h"
+#include "../ScanRegistration/Pose.h"
+#include "../ScanRegistration/SolverBudget.h"
+#include "../ScanRegistration/VoxelHashFilter.h"
 #include "../ScanRegistration/time_utils.h"
 #include "./DsvLoading/define.h"
 
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
-//#include <pcl/filters/voxel_grid.h>
-#include <pcl/keypoints/uniform_sampling.h>
 #include <pcl/common/transforms.h>
 #include <pcl/kdtree/kdtree_flann.h>
+#include <memory>
+#include <string>
 
 namespace loam
 {
@@ -53,29 +60,133 @@ public:
    explicit BasicLaserMapping(const float& scanPeriod = 0.1, const size_t& maxIterations = 10);
 
    /** \brief Try to process buffered data. */
-   void process(const pcl::PointCloud<pcl::PointXYZI>::Ptr,
-                const pcl::PointCloud<pcl::PointXYZI>& cornerPointsSharp,
-                const pcl::PointCloud<pcl::PointXYZI>& surPointsFlat,
+   void process(const pcl::PointCloud<PointXYZIRT>::Ptr,
+                const pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+                const pcl::PointCloud<PointXYZIRT>& surPointsFlat,
                 const long long& scanTime,
                 const std::vector<NAVDATA>&,
-                pcl::PointCloud<pcl::PointXYZI>::Ptr&);
-private:
-   Eigen::Affine3f NAVDATA2Transform(const NAVDATA& nav);
+                pcl::PointCloud<PointXYZIRT>::Ptr&);
+
+   /** \brief Set the wall-clock budget of a frame.
+    *
+    * The optimization stops early with the pose of the last completed iteration if the next iteration would
+    * exceed the budget. The clock starts when process() is called, so map maintenance counts against it.
+    *
+    * @param budget the budget (in ms, 0 = unlimited)
+    */
+   void setTimeBudget(const double& budget) { _solverBudget.setBudget(budget); }
+
+   /** \brief The frame deadline and the solver statistics. */
+   const SolverBudget& solverBudget() const { return _solverBudget; }
+
+   /** \brief Set the side length of the map cubes (clears the map).
+    *
+    * @param cubeSize the cube side length (in m)
+    */
+   void setCubeSize(const float& cubeSize)
+   {
+      _cubeMap.setCubeSize(cubeSize);
+      _mapTreesCurrent = false;
+   }
+
+   /** \brief Set the radius around the current position whose cubes are matched against.
+    *
+    * @param radius the search radius (in m), rounded up to whole cubes
+    */
+   void setSearchRadius(const float& radius) { _searchRadius = radius; }
 
+   /** \brief Set the maximum number of map cubes, the least recently used ones are evicted beyond it.
+    *
+    * @param maxCubes the maximum number of cubes (0 = unlimited)
+    */
+   void setMaxCubes(const size_t& maxCubes) { _cubeMap.setMaxCubes(maxCubes); }
+
+   /** \brief The sparse feature map. */
+   const CubeMap& cubeMap() const { return _cubeMap; }
+
+   /** \brief Keep the map out of core: spill evicted cubes to a tile directory and load them again along the
+    * predicted trajectory.
+    *
+    * Takes effect together with a maximum number of cubes (setMaxCubes()). Call before the first frame.
+    *
+    * @param directory the tile directory (created if it does not exist)
+    */
+   void setTileDirectory(const std::string& directory) { _tileStore.reset(new CubeTileStore(directory)); }
+
+   /** \brief Set how far ahead the NAV trajectory is followed to prefetch spilled cubes.
+    *
+    * @param horizon the prefetch horizon (in s)
+    */
+   void setPrefetchHorizon(const float& horizon) { _prefetchHorizon = horizon; }
+
+   /** \brief Save the feature map (all cubes, including spilled ones, and the down sampled surround map).
+    *
+    * Spilled cubes are read from the tile store one at a time while the file is written, they are not loaded back
+    * into the map.
+    *
+    * @param path the map file path
+    * @return true if the map was written, false otherwise
+    */
+   bool saveMap(const std::string& path);
+
+   /** \brief Load a feature map saved by saveMap(), replacing the current map.
+    *
+    * The next frame is matched against the loaded map right away. Call before the first frame.
+    *
+    * @param path the map file path
+    * @return true if the map was loaded, false otherwise (the map is unchanged then)
+    */
+   bool loadMap(const std::string& path);
+
+   /** \brief Enable or disable the localization-only mode.
+    *
+    * In localization mode the map is frozen: the scans are only matched against it, no points are inserted and
+    * neither the cubes nor the surround map are down sampled again. The map features and their KD-trees are
+    * kept as long as the vehicle stays within the same center cube. Use with a map from loadMap().
+    *
+    * The kept map features are a snapshot. Cube eviction, spilling and prefetching still run, so cubes that are
+    * loaded into or evicted from memory in the meantime are only reflected once the center cube changes.
+    *
+    * @param localizationMode true to only localize against the map, false to also build it
+    */
+   void setLocalizationMode(const bool& localizationMode) { _localizationMode = localizationMode; }
+   const bool& isLocalizationMode() const { return _localizationMode; }
+private:
    void interpolate(const vector<NAVDATA>& data, const long long& time, NAVDATA& result);
 
-   void DownsizePointCloud(const pcl::PointCloud<pcl::PointXYZI>&, pcl::PointCloud<pcl::PointXYZI>&, double);
+   void DownsizePointCloud(const pcl::PointCloud<PointXYZIRT>&, pcl::PointCloud<PointXYZIRT>&, double);
+
+   /** Update the residual Jacobian for the current transform. */
+   void updateJacobian();
 
    /** Run an optimization. */
    void optimizeTransformTobeMapped();
 
-   void pointAssociateToMap(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
+   void pointAssociateToMap(const PointXYZIRT& pi, PointXYZIRT& po);
 
    bool createDownsizedMap();
 
-   // private:
-   size_t toIndex(int i, int j, int k) const
-   { return i + _laserCloudWidth * j + _laserCloudWidth * _laserCloudHeight * k; }
+   /** \brief Collect the allocated cubes (in memory or on disk) within a range around a center cube.
+    *
+    * The cubes are stored in _laserCloudSurroundInd, sorted by key, and those in the field of view in
+    * _laserCloudValidInd.
+    */
+   void selectMapCubes(const CubeKey& center, const int& range, const PointXYZIRT& pointOnZAxis);
+
+   /** \brief Retrieve a map cube, loading it from the tile store if it was spilled.
+    *
+    * @param key the cube key
+    * @param create allocate the cube if it does not exist
+    * @return the cube, or NULL if it does not exist and create is false
+    */
+   CubeMap::Cube* mapCube(const CubeKey& key, const bool& create);
+
+   /** \brief Queue the loads of the spilled cubes within the search radius of the trajectory ahead.
+    *
+    * The trajectory is taken from the NAV data after the scan time; beyond the last NAV pose it is extrapolated
+    * with the velocity of the last two poses.
+    */
+   void prefetchAlongTrajectory(const std::vector<NAVDATA>& nav, const long long& scanTime);
 
 private:
    NAVDATA cur_state; /* 当前时刻位姿 */
@@ -90,41 +201,44 @@ private:
    size_t _maxIterations;  ///< maximum number of iterations
    float _deltaTAbort;     ///< optimization abort threshold for deltaT
    float _deltaRAbort;     ///< optimization abort threshold for deltaR
+   SolverBudget _solverBudget;   ///< per frame deadline and solver statistics
 
-   int _laserCloudCenWidth;
-   int _laserCloudCenHeight;
-   int _laserCloudCenDepth;
-   const size_t _laserCloudWidth;
-   const size_t _laserCloudHeight;
-   const size_t _laserCloudDepth;
-   const size_t _laserCloudNum;
+   CubeMap _cubeMap;        ///< sparse feature map
+   float _searchRadius;     ///< radius of the matched map cubes around the current position (in m)
+   std::unique_ptr<CubeTileStore> _tileStore;   ///< out-of-core storage of evicted cubes (NULL = evicted cubes are dropped)
+   float _prefetchHorizon;                      ///< time the NAV trajectory is followed to prefetch cubes (in s)
+   CubeTileStore::CubeList _tileCubes;          ///< cubes handed between the map and the tile store
 
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerLast;   ///< last corner points cloud
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfLast;     ///< last surface points cloud
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudFullRes;      ///< last full resolution cloud
+   bool _localizationMode;   ///< match against a frozen map only
+   bool _mapTreesCurrent;    ///< the map KD-trees are built from the current map feature clouds
+   CubeKey _mapCenter;       ///< center cube of the current map feature clouds
 
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerStack;
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfStack;
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerStackDS;  ///< down sampled
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfStackDS;    ///< down sampled
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerLast;   ///< last corner points cloud
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfLast;     ///< last surface points cloud
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudFullRes;      ///< last full resolution cloud
 
-   std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudCornerArray;
-   std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudSurfArray;
-   std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudCornerDSArray;  ///< down sampled
-   std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudSurfDSArray;    ///< down sampled
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerStack;
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfStack;
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerStackDS;  ///< down sampled
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfStackDS;    ///< down sampled
 
-   std::vector<size_t> _laserCloudValidInd; /* 保存视野内点的索引 */
-   std::vector<size_t> _laserCloudSurroundInd; /* 保存视野外点的索引 */
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCubeDS;   ///< down sampled cube cloud, swapped with the cube cloud
 
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerFromMap; /* 从map中找出的特征点 */
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfFromMap; /* 从map中找出的特征点 */
+   std::vector<CubeKey> _laserCloudValidInd; /* 保存视野内cube的坐标 */
+   std::vector<CubeKey> _laserCloudSurroundInd; /* 保存周围cube的坐标 */
 
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurround; /* 地图 */
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurroundDS;     ///< down sampled
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerFromMap; /* 从map中找出的特征点 */
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfFromMap; /* 从map中找出的特征点 */
 
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurround; /* 地图 */
+   pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurroundDS;     ///< down sampled
 
-   pcl::PointCloud<pcl::PointXYZI> _laserCloudOri;
-   pcl::PointCloud<pcl::PointXYZI> _coeffSel;
+
+   pcl::PointCloud<PointXYZIRT> _laserCloudStackSel;   ///< stack features transformed into the map frame
+   std::vector<int> _pointSearchInd;                   ///< batch search result: 5 nearest map points per feature
+   std::vector<float> _pointSearchSqDis;               ///< batch search result: squared distances of the nearest map points
+
+   PoseJacobian _jacobian;   ///< residual Jacobian for the current transform
 
    NAVDATA _transformSum;
    NAVDATA _transformGlobal;
@@ -133,6 +247,9 @@ private:
 
    CircularBuffer<IMUState2> _imuHistory;    ///< history of IMU states
 
+   VoxelHashFilter<PointXYZIRT> _downSizeFilter;      ///< down size filter for stack and cube clouds
+   VoxelHashFilter<PointXYZIRT> _downSizeFilterMap;   ///< down size filter for the surround map
+
    bool _downsizedMapCreated = false;
 
    NAVDATA _transform;
@@ -0,0 +1,260 @@
+#ifndef LOAM_CUBEMAP_H
+#define LOAM_CUBEMAP_H
+
+#include <cmath>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "../ScanRegistration/PointTypes.h"
+
+
+namespace loam {
+
+
+
+/** \brief Integer coordinates of a map cube. */
+struct CubeKey {
+  int i, j, k;
+
+  bool operator==(const CubeKey& other) const { return i == other.i && j == other.j && k == other.k; }
+  bool operator!=(const CubeKey& other) const { return !(*this == other); }
+};
+
+/** \brief Hash of cube coordinates (the usual large prime spatial hash). */
+struct CubeKeyHash {
+  size_t operator()(const CubeKey& key) const
+  {
+    return size_t((int64_t(key.i) * 73856093) ^ (int64_t(key.j) * 19349663) ^ (int64_t(key.k) * 83492791));
+  }
+};
+
+/** \brief Check if a cube lies within a range of cubes (per axis) around a center cube. */
+inline bool withinRange(const CubeKey& key, const CubeKey& center, const int& range)
+{
+  return std::abs(key.i - center.i) <= range && std::abs(key.j - center.j) <= range
+         && std::abs(key.k - center.k) <= range;
+}
+
+/** \brief The key of a cube key set or cube key map entry. */
+inline const CubeKey& keyOfEntry(const CubeKey& key) { return key; }
+
+template <class T>
+const CubeKey& keyOfEntry(const std::pair<const CubeKey, T>& entry) { return entry.first; }
+
+/** \brief Call a function for the entries of a cube key set or map within a range around a center cube.
+ *
+ * Looks up the keys of the range if there are fewer of them than entries and walks the entries otherwise, so
+ * keys without an entry cost at most one lookup each and a large range over a sparse map costs nothing extra.
+ *
+ * @param container the set or map
+ * @param center the center cube
+ * @param range the range (in cubes per axis)
+ * @param function the function, called with the container element
+ */
+template <class Container, class Function>
+void forEachWithinRange(Container& container, const CubeKey& center, const int& range, Function function)
+{
+  const size_t side = size_t(2 * range + 1);
+  if (side * side * side < container.size()) {
+    for (int i = center.i - range; i <= center.i + range; i++)
+      for (int j = center.j - range; j <= center.j + range; j++)
+        for (int k = center.k - range; k <= center.k + range; k++) {
+          auto it = container.find(CubeKey{ i, j, k });
+          if (it != container.end())
+            function(*it);
+        }
+  } else {
+    for (auto& entry : container)
+      if (withinRange(keyOfEntry(entry), center, range))
+        function(entry);
+  }
+}
+
+
+
+/** \brief Sparse feature map of cubic cells, keyed by integer cube coordinates.
+ *
+ * Cubes are allocated on first access, so memory is proportional to the explored area and there is no volume
+ * outside of which points are dropped. Cube (i, j, k) covers the cell of side cubeSize centered at
+ * (i, j, k) * cubeSize.
+ *
+ * Every access marks a cube as used in the current frame. If a maximum number of cubes is set, evict() drops the
+ * least recently used cubes beyond that number; cubes used in the current frame are never dropped. The evicted
+ * cubes can be handed to the caller, e.g. to spill them to disk and insert() them again later.
+ */
+class CubeMap {
+public:
+  typedef pcl::PointCloud<PointXYZIRT> Cloud;
+
+  /** \brief The feature clouds of a cube. */
+  struct Cube {
+    Cloud::Ptr corner;   ///< corner points
+    Cloud::Ptr surf;     ///< surface points
+
+    Cube() : corner(new Cloud()), surf(new Cloud()) {}
+  };
+
+  /** \brief Construct a new map.
+   *
+   * @param cubeSize the cube side length (in m)
+   * @param maxCubes the maximum number of cubes kept by evict() (0 = unlimited)
+   */
+  explicit CubeMap(const float& cubeSize = 200, const size_t& maxCubes = 0)
+        : _cubeSize(cubeSize),
+          _maxCubes(maxCubes),
+          _frame(0)
+  {}
+
+  /** \brief Set the cube side length (in m), clears the map. */
+  void setCubeSize(const float& cubeSize)
+  {
+    _cubeSize = cubeSize;
+    clear();
+  }
+
+  const float& getCubeSize() const { return _cubeSize; }
+
+  /** \brief Set the maximum number of cubes kept by evict() (0 = unlimited). */
+  void setMaxCubes(const size_t& maxCubes) { _maxCubes = maxCubes; }
+
+  const size_t& getMaxCubes() const { return _maxCubes; }
+
+  /** \brief The number of allocated cubes. */
+  size_t size() const { return _cubes.size(); }
+
+  /** \brief Remove all cubes. */
+  void clear()
+  {
+    _cubes.clear();
+    _lru.clear();
+  }
+
+  /** \brief The key of the cube containing a position. */
+  CubeKey keyOf(const float& x, const float& y, const float& z) const
+  {
+    const float half = _cubeSize / 2;
+    return CubeKey{ int(std::floor((x + half) / _cubeSize)),
+                    int(std::floor((y + half) / _cubeSize)),
+                    int(std::floor((z + half) / _cubeSize)) };
+  }
+
+  /** \brief Start a new frame: cubes accessed from now on are protected from eviction. */
+  void beginFrame() { _frame++; }
+
+  /** \brief Retrieve a cube, allocate it if it does not exist yet. */
+  Cube& cube(const CubeKey& key)
+  {
+    auto it = _cubes.find(key);
+    if (it == _cubes.end()) {
+      _lru.push_front(key);
+      it = _cubes.emplace(key, Entry(_lru.begin())).first;
+    }
+    touch(it->second);
+    return it->second.cube;
+  }
+
+  /** \brief Check if a cube is allocated (without marking it as used). */
+  bool contains(const CubeKey& key) const { return _cubes.count(key) > 0; }
+
+  /** \brief Insert a cube, e.g. one reloaded from disk (replaces an allocated cube with the same key). */
+  Cube& insert(const CubeKey& key, Cube&& cube)
+  {
+    Cube& target = this->cube(key);
+    target = std::move(cube);
+    return target;
+  }
+
+  /** \brief Retrieve a cube if it exists.
+   *
+   * @return the cube, or NULL if it was never filled or was evicted
+   */
+  Cube* find(const CubeKey& key)
+  {
+    auto it = _cubes.find(key);
+    if (it == _cubes.end())
+      return NULL;
+    touch(it->second);
+    return &it->second.cube;
+  }
+
+  /** \brief Call a function for every allocated cube (without marking it as used).
+   *
+   * @param function the function, called with the cube key and the cube
+   */
+  template <class Function>
+  void forEach(Function function)
+  {
+    for (auto& entry : _cubes)
+      function(entry.first, entry.second.cube);
+  }
+
+  /** \brief Call a function for every allocated cube within a range around a center cube (without marking it
+   * as used).
+   *
+   * @param center the center cube
+   * @param range the range (in cubes per axis)
+   * @param function the function, called with the cube key and the cube
+   */
+  template <class Function>
+  void forEachInRange(const CubeKey& center, const int& range, Function function)
+  {
+    forEachWithinRange(_cubes, center, range,
+                       [&function](std::pair<const CubeKey, Entry>& entry) { function(entry.first, entry.second.cube); });
+  }
+
+  /** \brief Drop the least recently used cubes beyond the maximum number of cubes.
+   *
+   * @param evicted the output dropped cubes (NULL = discard them)
+   * @return the number of dropped cubes
+   */
+  size_t evict(std::vector<std::pair<CubeKey, Cube> >* evicted = NULL)
+  {
+    size_t nEvicted = 0;
+    while (_maxCubes > 0 && _cubes.size() > _maxCubes) {
+      auto it = _cubes.find(_lru.back());
+      if (it->second.lastUsed == _frame)
+        break;   // all remaining cubes are in use
+      if (evicted)
+        evicted->emplace_back(it->first, std::move(it->second.cube));
+      _cubes.erase(it);
+      _lru.pop_back();
+      nEvicted++;
+    }
+    return nEvicted;
+  }
+
+private:
+  struct Entry {
+    Cube cube;                              ///< the feature clouds
+    std::list<CubeKey>::iterator lruPos;    ///< position in the LRU list
+    long lastUsed;                          ///< last frame the cube was accessed in
+
+    explicit Entry(const std::list<CubeKey>::iterator& pos) : lruPos(pos), lastUsed(-1) {}
+  };
+
+  void touch(Entry& entry)
+  {
+    if (entry.lastUsed != _frame) {
+      // moving once per frame keeps the list in LRU order at frame granularity
+      _lru.splice(_lru.begin(), _lru, entry.lruPos);
+      entry.lastUsed = _frame;
+    }
+  }
+
+  float _cubeSize;                                          ///< cube side length (in m)
+  size_t _maxCubes;                                         ///< maximum number of cubes kept (0 = unlimited)
+  long _frame;                                              ///< current frame
+  std::unordered_map<CubeKey, Entry, CubeKeyHash> _cubes;   ///< allocated cubes
+  std::list<CubeKey> _lru;                                  ///< cube keys, most recently used first
+};
+
+} // end namespace loam
+
+#endif //LOAM_CUBEMAP_H
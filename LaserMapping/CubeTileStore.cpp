@@ -0,0 +1,313 @@
+#include "CubeTileStore.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <sys/stat.h>
+
+namespace loam
+{
+
+namespace
+{
+
+/** Tile file header, followed by the corner and the surface points. */
+struct TileHeader
+{
+   uint32_t magic;
+   uint32_t pointSize;
+   uint64_t nCorner;
+   uint64_t nSurf;
+};
+
+const uint32_t TILE_MAGIC = 0x4c4f4d54;   // "TMOL"
+
+bool readPoints(FILE* file, const uint64_t& n, CubeMap::Cloud& cloud)
+{
+   cloud.points.resize(n);
+   cloud.width = uint32_t(n);
+   cloud.height = 1;
+   cloud.is_dense = true;
+   return n == 0 || std::fread(&cloud.points[0], sizeof(PointXYZIRT), n, file) == n;
+}
+
+} // end anonymous namespace
+
+
+CubeTileStore::CubeTileStore(const std::string& directory) :
+   _directory(directory),
+   _busy(false),
+   _stop(false)
+{
+   if (mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST)
+   {
+      std::cerr << "cannot create tile directory " << _directory << ": " << std::strerror(errno) << std::endl;
+   }
+   _worker = std::thread(&CubeTileStore::run, this);
+}
+
+CubeTileStore::~CubeTileStore()
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+   }
+   _jobAdded.notify_one();
+   _worker.join();
+}
+
+std::string CubeTileStore::tilePath(const CubeKey& key) const
+{
+   char name[64];
+   std::snprintf(name, sizeof(name), "/tile_%d_%d_%d.bin", key.i, key.j, key.k);
+   return _directory + name;
+}
+
+void CubeTileStore::spill(const CubeKey& key, CubeMap::Cube& cube)
+{
+   Job job;
+   job.write = true;
+   job.key = key;
+   job.cube = std::move(cube);
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push_back(std::move(job));
+   }
+   _jobAdded.notify_one();
+
+   _onDisk.insert(key);
+   _stats.spilled++;
+}
+
+void CubeTileStore::prefetch(const CubeKey& key)
+{
+   if (!contains(key) || !_requested.insert(key).second)
+   {
+      return;
+   }
+
+   Job job;
+   job.write = false;
+   job.key = key;
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push_back(std::move(job));
+   }
+   _jobAdded.notify_one();
+}
+
+void CubeTileStore::collect(CubeList& loaded)
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   for (auto& entry : _loaded)
+   {
+      auto unwritten = _unwritten.find(entry.first);
+      if (unwritten != _unwritten.end())
+      {
+         // the tile of a failed write was removed, the cube itself is the current data
+         loaded.emplace_back(entry.first, std::move(unwritten->second));
+         _unwritten.erase(unwritten);
+         _stats.failedWrites++;
+      }
+      else
+      {
+         if (!entry.second.valid)
+         {
+            _stats.failedLoads++;
+         }
+         loaded.emplace_back(entry.first, std::move(entry.second.cube));
+         _stats.prefetched++;
+      }
+      _onDisk.erase(entry.first);
+      _requested.erase(entry.first);
+   }
+   _loaded.clear();
+
+   for (auto it = _unwritten.begin(); it != _unwritten.end();)
+   {
+      if (_requested.count(it->first) > 0)
+      {
+         ++it;   // a load is queued, the cube is handed back together with its result
+         continue;
+      }
+      loaded.emplace_back(it->first, std::move(it->second));
+      _onDisk.erase(it->first);
+      _stats.failedWrites++;
+      it = _unwritten.erase(it);
+   }
+}
+
+bool CubeTileStore::take(const CubeKey& key, CubeMap::Cube& cube)
+{
+   // a load that is not queued yet goes to the end of the queue, behind a pending spill of the same cube
+   prefetch(key);
+   _stats.blockingLoads++;
+
+   std::unique_lock<std::mutex> lock(_mutex);
+   _cubeLoaded.wait(lock, [this, &key]() { return _loaded.count(key) > 0; });
+
+   auto it = _loaded.find(key);
+   bool valid = it->second.valid;
+   auto unwritten = _unwritten.find(key);
+   if (unwritten != _unwritten.end())
+   {
+      cube = std::move(unwritten->second);
+      _unwritten.erase(unwritten);
+      _stats.failedWrites++;
+      valid = true;
+   }
+   else
+   {
+      cube = std::move(it->second.cube);
+      if (!valid)
+      {
+         _stats.failedLoads++;
+      }
+   }
+   _loaded.erase(it);
+   lock.unlock();
+
+   _onDisk.erase(key);
+   _requested.erase(key);
+   return valid;
+}
+
+bool CubeTileStore::read(const CubeKey& key, CubeMap::Cube& cube)
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   _idle.wait(lock, [this]() { return _jobs.empty() && !_busy; });
+
+   auto unwritten = _unwritten.find(key);
+   if (unwritten != _unwritten.end())
+   {
+      *cube.corner = *unwritten->second.corner;
+      *cube.surf = *unwritten->second.surf;
+      return true;
+   }
+   lock.unlock();
+
+   // only this thread queues jobs, so the I/O thread stays idle while the tile is read
+   return readTile(key, cube);
+}
+
+void CubeTileStore::run()
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   while (true)
+   {
+      _jobAdded.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+      if (_jobs.empty())
+      {
+         return;   // stopped, all spills are written
+      }
+
+      Job job = std::move(_jobs.front());
+      _jobs.pop_front();
+      _busy = true;
+      lock.unlock();
+
+      if (job.write)
+      {
+         const bool written = writeTile(job.key, job.cube);
+         if (!written)
+         {
+            // a tile of an earlier spill must not be loaded in place of the cube
+            std::remove(tilePath(job.key).c_str());
+         }
+         lock.lock();
+         if (!written)
+         {
+            _unwritten[job.key] = std::move(job.cube);
+         }
+      }
+      else
+      {
+         LoadedCube loaded;
+         loaded.valid = readTile(job.key, loaded.cube);
+         lock.lock();
+         _loaded[job.key] = std::move(loaded);
+         _cubeLoaded.notify_all();
+      }
+
+      _busy = false;
+      if (_jobs.empty())
+      {
+         _idle.notify_all();
+      }
+   }
+}
+
+bool CubeTileStore::writeTile(const CubeKey& key, const CubeMap::Cube& cube) const
+{
+   // write to a temporary file first, so a tile is never read half written
+   const std::string path = tilePath(key);
+   const std::string tmpPath = path + ".tmp";
+   FILE* file = std::fopen(tmpPath.c_str(), "wb");
+   if (!file)
+   {
+      std::cerr << "cannot write tile " << tmpPath << ": " << std::strerror(errno) << std::endl;
+      return false;
+   }
+
+   TileHeader header;
+   header.magic = TILE_MAGIC;
+   header.pointSize = sizeof(PointXYZIRT);
+   header.nCorner = cube.corner->points.size();
+   header.nSurf = cube.surf->points.size();
+
+   bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+   if (ok && header.nCorner > 0)
+   {
+      ok = std::fwrite(&cube.corner->points[0], sizeof(PointXYZIRT), header.nCorner, file) == header.nCorner;
+   }
+   if (ok && header.nSurf > 0)
+   {
+      ok = std::fwrite(&cube.surf->points[0], sizeof(PointXYZIRT), header.nSurf, file) == header.nSurf;
+   }
+   ok = std::fclose(file) == 0 && ok;
+
+   if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+   {
+      std::cerr << "cannot write tile " << path << std::endl;
+      std::remove(tmpPath.c_str());
+      return false;
+   }
+   return true;
+}
+
+bool CubeTileStore::readTile(const CubeKey& key, CubeMap::Cube& cube) const
+{
+   const std::string path = tilePath(key);
+   FILE* file = std::fopen(path.c_str(), "rb");
+   if (!file)
+   {
+      std::cerr << "cannot read tile " << path << ": " << std::strerror(errno) << std::endl;
+      return false;
+   }
+
+   // the points are read straight into the clouds, they are copied exactly once
+   struct stat st;
+   TileHeader header;
+   bool valid = fstat(fileno(file), &st) == 0
+                && std::fread(&header, sizeof(header), 1, file) == 1
+                && header.magic == TILE_MAGIC
+                && header.pointSize == sizeof(PointXYZIRT)
+                && sizeof(header) + (header.nCorner + header.nSurf) * sizeof(PointXYZIRT) == size_t(st.st_size);
+   valid = valid
+           && readPoints(file, header.nCorner, *cube.corner)
+           && readPoints(file, header.nSurf, *cube.surf);
+   std::fclose(file);
+
+   if (!valid)
+   {
+      std::cerr << "invalid tile " << path << std::endl;
+      cube.corner->clear();
+      cube.surf->clear();
+   }
+   return valid;
+}
+
+} // end namespace loam
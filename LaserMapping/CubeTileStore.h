@@ -0,0 +1,150 @@
+#ifndef LOAM_CUBETILESTORE_H
+#define LOAM_CUBETILESTORE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "CubeMap.h"
+
+
+namespace loam {
+
+
+
+/** \brief Out-of-core storage of map cubes on local disk.
+ *
+ * Cubes evicted from the in-memory map are spilled to one tile file per cube and read straight into the cube
+ * clouds again when the vehicle comes back. All file I/O runs on a background thread in request order, so a load
+ * always sees the last spill of its cube. prefetch() queues the load of a tile ahead of time; collect() hands over
+ * the finished prefetches without blocking. take() returns a tile immediately when it is needed, waiting for its
+ * load if necessary.
+ *
+ * A spilled cube stays with its write job until the tile is written. If the write fails, the cube is kept in
+ * memory and handed back by collect() (or take()) instead of its tile, so no data is lost.
+ *
+ * The tiles are raw point dumps for this process, not an exchange format. All methods have to be called from the
+ * same (mapping) thread.
+ */
+class CubeTileStore {
+public:
+  typedef std::vector<std::pair<CubeKey, CubeMap::Cube> > CubeList;
+
+  /** \brief Tile store statistics. */
+  struct Statistics {
+    size_t spilled = 0;         ///< number of spilled tiles
+    size_t prefetched = 0;      ///< number of tiles loaded ahead of time
+    size_t blockingLoads = 0;   ///< number of tiles needed before their prefetch was collected
+    size_t failedLoads = 0;     ///< number of tiles that could not be read
+    size_t failedWrites = 0;    ///< number of cubes handed back because their tile could not be written
+  };
+
+  /** \brief Construct a new store.
+   *
+   * @param directory the tile directory (created if it does not exist)
+   */
+  explicit CubeTileStore(const std::string& directory);
+
+  /** \brief Wait for all pending writes and stop the I/O thread. */
+  ~CubeTileStore();
+
+  CubeTileStore(const CubeTileStore&) = delete;
+  CubeTileStore& operator=(const CubeTileStore&) = delete;
+
+  const Statistics& getStatistics() const { return _stats; }
+
+  /** \brief The number of cubes on disk (spilled and not taken back). */
+  size_t size() const { return _onDisk.size(); }
+
+  /** \brief Check if a cube is on disk. */
+  bool contains(const CubeKey& key) const { return _onDisk.count(key) > 0; }
+
+  /** \brief The keys of the cubes on disk. */
+  std::vector<CubeKey> keys() const { return std::vector<CubeKey>(_onDisk.begin(), _onDisk.end()); }
+
+  /** \brief Call a function for the key of every cube on disk within a range around a center cube. */
+  template <class Function>
+  void forEachInRange(const CubeKey& center, const int& range, Function function) const
+  {
+    forEachWithinRange(_onDisk, center, range, function);
+  }
+
+  /** \brief Spill a cube to disk (asynchronously).
+   *
+   * @param key the cube key
+   * @param cube the cube, its clouds are taken over
+   */
+  void spill(const CubeKey& key, CubeMap::Cube& cube);
+
+  /** \brief Queue the load of a cube if it is on disk and not yet requested. */
+  void prefetch(const CubeKey& key);
+
+  /** \brief Hand over all finished prefetches and the cubes whose tile could not be written.
+   *
+   * @param loaded the output cubes (appended)
+   */
+  void collect(CubeList& loaded);
+
+  /** \brief Retrieve a cube from disk, waiting for its load if necessary.
+   *
+   * @param key the cube key, has to be on disk
+   * @param cube the output cube
+   * @return true if the tile was read, false if it could not be read (the cube is empty then)
+   */
+  bool take(const CubeKey& key, CubeMap::Cube& cube);
+
+  /** \brief Read a cube on disk without taking it out of the store, e.g. to save the map.
+   *
+   * Waits until all queued I/O is done, so the tile holds the last spill of the cube.
+   *
+   * @param key the cube key, has to be on disk
+   * @param cube the output cube
+   * @return true if the cube was read, false if its tile could not be read (the cube is empty then)
+   */
+  bool read(const CubeKey& key, CubeMap::Cube& cube);
+
+private:
+  struct Job {
+    bool write;             ///< write or read job
+    CubeKey key;            ///< cube key
+    CubeMap::Cube cube;     ///< cube to write
+  };
+
+  /** Loaded cube, with the result of the read. */
+  struct LoadedCube {
+    CubeMap::Cube cube;
+    bool valid;
+  };
+
+  void run();
+
+  std::string tilePath(const CubeKey& key) const;
+  bool writeTile(const CubeKey& key, const CubeMap::Cube& cube) const;
+  bool readTile(const CubeKey& key, CubeMap::Cube& cube) const;
+
+  std::string _directory;                                     ///< tile directory
+  std::unordered_set<CubeKey, CubeKeyHash> _onDisk;           ///< cubes whose current data is on disk
+  std::unordered_set<CubeKey, CubeKeyHash> _requested;        ///< cubes with a queued or finished load
+  Statistics _stats;                                          ///< store statistics
+
+  std::mutex _mutex;                                          ///< guards the job queue and the loaded cubes
+  std::condition_variable _jobAdded;                          ///< signaled when a job is queued
+  std::condition_variable _cubeLoaded;                        ///< signaled when a load finished
+  std::condition_variable _idle;                              ///< signaled when the I/O thread runs out of jobs
+  std::deque<Job> _jobs;                                      ///< pending I/O jobs
+  std::unordered_map<CubeKey, LoadedCube, CubeKeyHash> _loaded;   ///< finished loads
+  std::unordered_map<CubeKey, CubeMap::Cube, CubeKeyHash> _unwritten;   ///< spilled cubes whose write failed
+  bool _busy;                                                 ///< the I/O thread is running a job
+  bool _stop;                                                 ///< stop the I/O thread once the queue is empty
+  std::thread _worker;                                        ///< I/O thread
+};
+
+} // end namespace loam
+
+#endif //LOAM_CUBETILESTORE_H
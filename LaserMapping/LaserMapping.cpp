@@ -236,12 +236,12 @@ bool LaserMapping::hasNewData()
       fabs((_timeLaserCloudFullRes - _timeLaserOdometry).toSec()) < 0.005;
 }
 */
-void LaserMapping::process(const pcl::PointCloud<pcl::PointXYZI>::Ptr laserCloudIn,
-    const pcl::PointCloud<pcl::PointXYZI>& cornerPointsSharp,
-    const pcl::PointCloud<pcl::PointXYZI>& surPointsFlat,
+void LaserMapping::process(const pcl::PointCloud<PointXYZIRT>::Ptr laserCloudIn,
+    const pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+    const pcl::PointCloud<PointXYZIRT>& surPointsFlat,
     const long long& scanTime,
     const std::vector<NAVDATA>& nav,
-    pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudMap)
+    pcl::PointCloud<PointXYZIRT>::Ptr& laserCloudMap)
 {
    BasicLaserMapping::process(laserCloudIn, cornerPointsSharp,  surPointsFlat, scanTime, nav, laserCloudMap);
 }
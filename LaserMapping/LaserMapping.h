@@ -55,12 +55,12 @@ public:
 //   void spin();
 
    /** \brief Try to process buffered data. */
-   void process(const pcl::PointCloud<pcl::PointXYZI>::Ptr,
-           const pcl::PointCloud<pcl::PointXYZI>& cornerPointsSharp,
-           const pcl::PointCloud<pcl::PointXYZI>& surPointsFlat,
+   void process(const pcl::PointCloud<PointXYZIRT>::Ptr,
+           const pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+           const pcl::PointCloud<PointXYZIRT>& surPointsFlat,
            const long long& scanTime,
            const std::vector<NAVDATA>&,
-           pcl::PointCloud<pcl::PointXYZI>::Ptr&);
+           pcl::PointCloud<PointXYZIRT>::Ptr&);
 
 
 protected:
@@ -0,0 +1,233 @@
+#include "MapFile.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace loam
+{
+
+namespace
+{
+
+const char MAP_MAGIC[8] = { 'L', 'O', 'A', 'M', 'M', 'A', 'P', 0 };
+const uint32_t MAP_VERSION = 1;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const uint64_t BLOCK_ALIGNMENT = 64;
+
+/** Map file header. */
+struct MapFileHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t byteOrder;
+   uint32_t pointSize;
+   float cubeSize;
+   uint64_t nCubes;
+   uint64_t surroundOffset;   ///< byte offset of the surround map points
+   uint64_t nSurround;
+   uint64_t fileSize;
+};
+
+/** Cube table entry. */
+struct MapFileCube
+{
+   int32_t i, j, k;
+   uint32_t reserved;
+   uint64_t cornerOffset;     ///< byte offset of the corner points
+   uint64_t nCorner;
+   uint64_t surfOffset;       ///< byte offset of the surface points
+   uint64_t nSurf;
+};
+
+uint64_t align(const uint64_t& offset)
+{
+   return (offset + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+}
+
+/** Reserve an aligned point block, returns its offset. */
+uint64_t reserveBlock(uint64_t& fileSize, const uint64_t& nPoints)
+{
+   const uint64_t offset = align(fileSize);
+   fileSize = offset + nPoints * sizeof(PointXYZIRT);
+   return offset;
+}
+
+bool writeBlock(FILE* file, const uint64_t& offset, const pcl::PointCloud<PointXYZIRT>& cloud)
+{
+   if (std::fseek(file, long(offset), SEEK_SET) != 0)
+   {
+      return false;
+   }
+   return cloud.points.empty()
+          || std::fwrite(&cloud.points[0], sizeof(PointXYZIRT), cloud.points.size(), file) == cloud.points.size();
+}
+
+bool checkBlock(const uint64_t& offset, const uint64_t& nPoints, const uint64_t& fileSize)
+{
+   return offset % alignof(PointXYZIRT) == 0
+          && offset <= fileSize
+          && nPoints <= (fileSize - offset) / sizeof(PointXYZIRT);
+}
+
+void readBlock(const char* data, const uint64_t& offset, const uint64_t& nPoints, pcl::PointCloud<PointXYZIRT>& cloud)
+{
+   cloud.points.resize(nPoints);
+   if (nPoints > 0)
+   {
+      std::memcpy(&cloud.points[0], data + offset, nPoints * sizeof(PointXYZIRT));
+   }
+   cloud.width = uint32_t(nPoints);
+   cloud.height = 1;
+   cloud.is_dense = true;
+}
+
+} // end anonymous namespace
+
+
+bool saveMapFile(const std::string& path, CubeMap& map, const pcl::PointCloud<PointXYZIRT>& surroundMap,
+                 const std::vector<CubeKey>& storedCubes, const CubeLoader& loadCube)
+{
+   const std::string tmpPath = path + ".tmp";
+   FILE* file = std::fopen(tmpPath.c_str(), "wb");
+   if (!file)
+   {
+      std::cerr << "cannot write map file " << tmpPath << ": " << std::strerror(errno) << std::endl;
+      return false;
+   }
+
+   /* 点块依次写在文件头及cube表之后, 文件头和cube表最后写入 */
+   std::vector<MapFileCube> cubes;
+   cubes.reserve(map.size() + storedCubes.size());
+   uint64_t fileSize = sizeof(MapFileHeader) + (map.size() + storedCubes.size()) * sizeof(MapFileCube);
+   bool ok = true;
+   auto writeCube = [file, &cubes, &fileSize, &ok](const CubeKey& key, const CubeMap::Cube& cube)
+   {
+      MapFileCube entry;
+      entry.i = key.i;
+      entry.j = key.j;
+      entry.k = key.k;
+      entry.reserved = 0;
+      entry.nCorner = cube.corner->points.size();
+      entry.cornerOffset = reserveBlock(fileSize, entry.nCorner);
+      entry.nSurf = cube.surf->points.size();
+      entry.surfOffset = reserveBlock(fileSize, entry.nSurf);
+      ok = ok
+           && writeBlock(file, entry.cornerOffset, *cube.corner)
+           && writeBlock(file, entry.surfOffset, *cube.surf);
+      cubes.push_back(entry);
+   };
+
+   map.forEach(writeCube);
+
+   /* 不在内存中的cube逐个读入, 写完即释放 */
+   for (size_t i = 0; ok && i < storedCubes.size(); i++)
+   {
+      CubeMap::Cube cube;
+      ok = loadCube(storedCubes[i], cube);
+      if (ok)
+      {
+         writeCube(storedCubes[i], cube);
+      }
+   }
+
+   MapFileHeader header;
+   std::memcpy(header.magic, MAP_MAGIC, sizeof(MAP_MAGIC));
+   header.version = MAP_VERSION;
+   header.byteOrder = BYTE_ORDER_MARK;
+   header.pointSize = sizeof(PointXYZIRT);
+   header.cubeSize = map.getCubeSize();
+   header.nCubes = cubes.size();
+   header.nSurround = surroundMap.points.size();
+   header.surroundOffset = reserveBlock(fileSize, header.nSurround);
+   header.fileSize = fileSize;
+
+   ok = ok
+        && writeBlock(file, header.surroundOffset, surroundMap)
+        && std::fseek(file, 0, SEEK_SET) == 0
+        && std::fwrite(&header, sizeof(header), 1, file) == 1
+        && (cubes.empty() || std::fwrite(&cubes[0], sizeof(MapFileCube), cubes.size(), file) == cubes.size());
+   // the last block may be empty, extend the file to its full size
+   ok = ok && std::fflush(file) == 0 && ftruncate(fileno(file), off_t(fileSize)) == 0;
+   ok = std::fclose(file) == 0 && ok;
+
+   if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+   {
+      std::cerr << "cannot write map file " << path << std::endl;
+      std::remove(tmpPath.c_str());
+      return false;
+   }
+   return true;
+}
+
+bool loadMapFile(const std::string& path, CubeMap& map, pcl::PointCloud<PointXYZIRT>& surroundMap)
+{
+   const int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0)
+   {
+      std::cerr << "cannot read map file " << path << ": " << std::strerror(errno) << std::endl;
+      return false;
+   }
+
+   struct stat st;
+   void* data = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(MapFileHeader))
+   {
+      data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   }
+   close(fd);
+   if (data == MAP_FAILED)
+   {
+      std::cerr << "cannot map map file " << path << std::endl;
+      return false;
+   }
+
+   const char* bytes = static_cast<const char*>(data);
+   const uint64_t fileSize = uint64_t(st.st_size);
+   const MapFileHeader* header = reinterpret_cast<const MapFileHeader*>(bytes);
+   const MapFileCube* cubes = reinterpret_cast<const MapFileCube*>(bytes + sizeof(MapFileHeader));
+
+   /* 检查文件头及所有点块的范围 */
+   bool valid = std::memcmp(header->magic, MAP_MAGIC, sizeof(MAP_MAGIC)) == 0
+                && header->version == MAP_VERSION
+                && header->byteOrder == BYTE_ORDER_MARK
+                && header->pointSize == sizeof(PointXYZIRT)
+                && header->cubeSize > 0
+                && header->fileSize == fileSize
+                && header->nCubes <= (fileSize - sizeof(MapFileHeader)) / sizeof(MapFileCube)
+                && checkBlock(header->surroundOffset, header->nSurround, fileSize);
+   for (uint64_t i = 0; valid && i < header->nCubes; i++)
+   {
+      valid = checkBlock(cubes[i].cornerOffset, cubes[i].nCorner, fileSize)
+              && checkBlock(cubes[i].surfOffset, cubes[i].nSurf, fileSize);
+   }
+
+   if (valid)
+   {
+      map.setCubeSize(header->cubeSize);
+      for (uint64_t i = 0; i < header->nCubes; i++)
+      {
+         CubeMap::Cube& cube = map.cube(CubeKey{ cubes[i].i, cubes[i].j, cubes[i].k });
+         readBlock(bytes, cubes[i].cornerOffset, cubes[i].nCorner, *cube.corner);
+         readBlock(bytes, cubes[i].surfOffset, cubes[i].nSurf, *cube.surf);
+      }
+      readBlock(bytes, header->surroundOffset, header->nSurround, surroundMap);
+   }
+   else
+   {
+      std::cerr << "invalid map file " << path << std::endl;
+   }
+
+   munmap(data, st.st_size);
+   return valid;
+}
+
+} // end namespace loam
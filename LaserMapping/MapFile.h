@@ -0,0 +1,59 @@
+#ifndef LOAM_MAPFILE_H
+#define LOAM_MAPFILE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "CubeMap.h"
+#include "../ScanRegistration/PointTypes.h"
+
+
+namespace loam {
+
+
+
+/** \brief Loads a map cube that is not in memory, returns false if it cannot be loaded. */
+typedef std::function<bool(const CubeKey&, CubeMap::Cube&)> CubeLoader;
+
+/** \brief Save a feature map to a binary map file.
+ *
+ * The file holds a header, a table of the cubes and one contiguous, aligned block of points per cloud (the
+ * corner and surface points of every cube, then the down sampled surround map). The cube clouds are stored as
+ * they are, i.e. in their down sampled state. The file is written to a temporary path first and renamed, so an
+ * interrupted save never leaves a broken map behind.
+ *
+ * Cubes that are not in the cube map, e.g. spilled ones, are passed by key and loaded one at a time while the file
+ * is written, so the whole map never has to fit into memory.
+ *
+ * Points are stored in their in-memory layout, so map files are only exchangeable between builds with the same
+ * point type and byte order; the loader rejects others.
+ *
+ * @param path the map file path
+ * @param map the cube map (not marked as used)
+ * @param surroundMap the down sampled surround map
+ * @param storedCubes the keys of the cubes that are not in the cube map
+ * @param loadCube the loader of the stored cubes
+ * @return true if the map was written, false otherwise (also if a stored cube could not be loaded)
+ */
+bool saveMapFile(const std::string& path, CubeMap& map, const pcl::PointCloud<PointXYZIRT>& surroundMap,
+                 const std::vector<CubeKey>& storedCubes = std::vector<CubeKey>(),
+                 const CubeLoader& loadCube = CubeLoader());
+
+/** \brief Load a feature map from a binary map file.
+ *
+ * The file is memory mapped and every point block is copied into its cloud in one go. The cube map is cleared
+ * and takes over the cube size of the file.
+ *
+ * @param path the map file path
+ * @param map the output cube map
+ * @param surroundMap the output down sampled surround map
+ * @return true if the map was loaded, false if the file could not be read or is invalid (the map is unchanged then)
+ */
+bool loadMapFile(const std::string& path, CubeMap& map, pcl::PointCloud<PointXYZIRT>& surroundMap);
+
+} // end namespace loam
+
+#endif //LOAM_MAPFILE_H
@@ -0,0 +1,95 @@
+#ifndef LOAM_MORTONORDER_H
+#define LOAM_MORTONORDER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+
+namespace loam {
+
+
+
+/** \brief Spread the lower 21 bits of a value so that two zero bits follow every bit. */
+inline uint64_t mortonSpread(uint64_t v)
+{
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x001f00000000ffffull;
+  v = (v | v << 16) & 0x001f0000ff0000ffull;
+  v = (v | v << 8)  & 0x100f00f00f00f00full;
+  v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2)  & 0x1249249249249249ull;
+  return v;
+}
+
+/** \brief Interleave three 21 bit grid coordinates to a 63 bit Morton (Z-order) code. */
+inline uint64_t mortonCode(const uint32_t& x, const uint32_t& y, const uint32_t& z)
+{
+  return mortonSpread(x) | (mortonSpread(y) << 1) | (mortonSpread(z) << 2);
+}
+
+
+
+/** \brief Calculate the Morton (Z-order) sequence of a point buffer.
+ *
+ * The points are quantized to a 2^21 grid over their bounding box and ordered by the Morton code of their cell.
+ * Points that are consecutive in this order are close in space, so e.g. consecutive nearest neighbor queries
+ * descend into the same tree nodes and hit the same cache lines.
+ *
+ * @param points the first point (any type with x, y and z members)
+ * @param nPoints the number of points
+ * @param order the output sequence of point indices
+ * @param codes the sort buffer (kept by the caller, so repeated calls do not allocate)
+ */
+template <class PointT>
+void mortonOrder(const PointT* points, const size_t& nPoints,
+                 std::vector<int>& order, std::vector<std::pair<uint64_t, int> >& codes)
+{
+  order.resize(nPoints);
+  codes.resize(nPoints);
+  if (nPoints == 0)
+    return;
+
+  float lo[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                  std::numeric_limits<float>::max() };
+  float hi[3] = { -lo[0], -lo[1], -lo[2] };
+  for (size_t i = 0; i < nPoints; i++) {
+    const PointT& p = points[i];
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+      continue;
+    lo[0] = std::min(lo[0], p.x);
+    lo[1] = std::min(lo[1], p.y);
+    lo[2] = std::min(lo[2], p.z);
+    hi[0] = std::max(hi[0], p.x);
+    hi[1] = std::max(hi[1], p.y);
+    hi[2] = std::max(hi[2], p.z);
+  }
+
+  // one common scale keeps the cells cubic
+  const float extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+  const float scale = extent > 0 ? float(0x1ffffe) / extent : 0.0f;   // one cell of margin against rounding
+
+  for (size_t i = 0; i < nPoints; i++) {
+    const PointT& p = points[i];
+    if (std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z)) {
+      codes[i].first = mortonCode(uint32_t((p.x - lo[0]) * scale),
+                                  uint32_t((p.y - lo[1]) * scale),
+                                  uint32_t((p.z - lo[2]) * scale));
+    } else {
+      // invalid points go last
+      codes[i].first = std::numeric_limits<uint64_t>::max();
+    }
+    codes[i].second = int(i);
+  }
+  std::sort(codes.begin(), codes.end());
+
+  for (size_t i = 0; i < nPoints; i++)
+    order[i] = codes[i].second;
+}
+
+} // end namespace loam
+
+#endif //LOAM_MORTONORDER_H
@@ -41,16 +41,25 @@
 #ifndef NANO_KDTREE_KDTREE_FLANN_H_
 #define NANO_KDTREE_KDTREE_FLANN_H_
 
+#include <algorithm>
+#include <limits>
+#include <vector>
 #include <boost/shared_ptr.hpp>
+#include <Eigen/Core>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include "nanoflann.hpp"
+#include "KdTree3f.h"
+#include "MortonOrder.h"
 
 namespace nanoflann
 {
 
 // Adapter class to give to nanoflann the same "look and fell" of pcl::KdTreeFLANN.
 // limited to squared distance between 3D points
+// The points are indexed by loam::KdTree3f, a tree specialized for 3D float points over packed coordinates.
+// Clouds up to the leaf size form a single leaf and are searched linearly, which is where a linear scan beats
+// the tree, so there is no separate brute force path.
 template <typename PointT>
 class KdTreeFLANN
 {
@@ -74,6 +83,12 @@ public:
 
     void  setSortedResults (bool sorted);
 
+    // maximum number of points per tree leaf, must be set before setInputCloud
+    void  setLeafSize (size_t leafSize);
+
+    // run the queries of batch searches in Morton order (default), so consecutive queries are close in space
+    void  setMortonOrderedBatches (bool enabled);
+
     inline Ptr makeShared () { return Ptr (new KdTreeFLANN<PointT> (*this)); }
 
     void setInputCloud (const PointCloudPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr ());
@@ -81,37 +96,48 @@ public:
     int  nearestKSearch (const PointT &point, int k, std::vector<int> &k_indices,
                          std::vector<float> &k_sqr_distances) const;
 
+    // k nearest neighbour search into caller provided arrays of length k, returns the number of neighbours found
+    // does not allocate, e.g. for many single queries with small k on stack arrays
+    int  knnSearch (const PointT &point, int k, int *k_indices, float *k_sqr_distances) const;
+
+    // batch search for the k nearest neighbours of every point of a query cloud
+    // the results of query i are written to the flat arrays at [i * k, i * k + k), sorted by distance; missing
+    // neighbours are reported as index -1 with distance FLT_MAX. The arrays are only resized, so reusing them across
+    // calls does not allocate. With parallel = true the queries are distributed over the OpenMP threads.
+    // Batch searches on the same tree must not run concurrently (they share the query ordering buffers).
+    // returns the number of queries that found k neighbours
+    int  nearestKSearch (const PointCloud &queries, int k, std::vector<int> &k_indices,
+                         std::vector<float> &k_sqr_distances, bool parallel = false) const;
+
     int radiusSearch (const PointT &point, double radius, std::vector<int> &k_indices,
                       std::vector<float> &k_sqr_distances) const;
 
+    // smallest batch that is sorted into Morton order
+    static const size_t MORTON_MIN_BATCH = 256;
+
 private:
 
     nanoflann::SearchParams _params;
 
-    struct PointCloud_Adaptor
-    {
-      inline size_t kdtree_get_point_count() const;
-      inline float kdtree_get_pt(const size_t idx, int dim) const;
-      template <class BBOX> bool kdtree_get_bbox(BBOX&) const { return false; }
-      PointCloudConstPtr pcl;
-      IndicesConstPtr indices;
-    };
+    size_t _leafSize;
+    bool _mortonBatches;
 
-    typedef nanoflann::KDTreeSingleIndexAdaptor<
-      nanoflann::SO3_Adaptor<float, PointCloud_Adaptor > ,
-      PointCloud_Adaptor, 3, int> KDTreeFlann_PCL_SO3;
+    loam::KdTree3f _kdtree;
 
-    PointCloud_Adaptor _adaptor;
-
-    KDTreeFlann_PCL_SO3 _kdtree;
+    mutable std::vector<int> _queryOrder;                             // batch query sequence
+    mutable std::vector<std::pair<uint64_t, int> > _queryCodes;       // batch query Morton codes
 
 };
 
 //---------- Definitions ---------------------
 
+template<typename PointT>
+const size_t KdTreeFLANN<PointT>::MORTON_MIN_BATCH;
+
 template<typename PointT> inline
 KdTreeFLANN<PointT>::KdTreeFLANN(bool sorted):
-    _kdtree(3,_adaptor)
+    _leafSize(loam::KdTree3f::DEFAULT_LEAF_SIZE),
+    _mortonBatches(true)
 {
     _params.sorted = sorted;
 }
@@ -128,13 +154,36 @@ void KdTreeFLANN<PointT>::setSortedResults(bool sorted)
     _params.sorted = sorted;
 }
 
+template<typename PointT> inline
+void KdTreeFLANN<PointT>::setLeafSize(size_t leafSize)
+{
+    _leafSize = leafSize;
+}
+
+template<typename PointT> inline
+void KdTreeFLANN<PointT>::setMortonOrderedBatches(bool enabled)
+{
+    _mortonBatches = enabled;
+}
+
 template<typename PointT> inline
 void KdTreeFLANN<PointT>::setInputCloud(const KdTreeFLANN::PointCloudPtr &cloud,
                                         const IndicesConstPtr &indices)
 {
-    _adaptor.pcl = cloud;
-    _adaptor.indices = indices;
-    _kdtree.buildIndex();
+    // reported indices are positions in the indices vector (if given), as in pcl::KdTreeFLANN
+    const size_t n = indices ? indices->size() : cloud->points.size();
+    _kdtree.setLeafSize(_leafSize);
+    _kdtree.build(cloud->points.data(), indices ? indices->data() : NULL, n);
+}
+
+template<typename PointT> inline
+int KdTreeFLANN<PointT>::knnSearch(const PointT &point, int num_closest,
+                                   int *k_indices, float *k_sqr_distances) const
+{
+    nanoflann::KNNResultSet<float,int> resultSet(num_closest);
+    resultSet.init(k_indices, k_sqr_distances);
+    _kdtree.search(point.data, resultSet, _params.eps);
+    return resultSet.size();
 }
 
 template<typename PointT> inline
@@ -145,10 +194,40 @@ int KdTreeFLANN<PointT>::nearestKSearch(const PointT &point, int num_closest,
     k_indices.resize(num_closest);
     k_sqr_distances.resize(num_closest);
 
-    nanoflann::KNNResultSet<float,int> resultSet(num_closest);
-    resultSet.init( k_indices.data(), k_sqr_distances.data());
-    _kdtree.findNeighbors(resultSet, point.data, nanoflann::SearchParams() );
-    return resultSet.size();
+    return knnSearch(point, num_closest, k_indices.data(), k_sqr_distances.data());
+}
+
+template<typename PointT> inline
+int KdTreeFLANN<PointT>::nearestKSearch(const PointCloud &queries, int num_closest,
+                                std::vector<int> &k_indices,
+                                std::vector<float> &k_sqr_distances,
+                                bool parallel) const
+{
+    const int nQueries = int(queries.points.size());
+    k_indices.resize(size_t(nQueries) * num_closest);
+    k_sqr_distances.resize(size_t(nQueries) * num_closest);
+
+    // the results are written to the slots of the original query positions, so no reordering is needed afterwards
+    const bool ordered = _mortonBatches && size_t(nQueries) >= MORTON_MIN_BATCH;
+    if (ordered)
+        loam::mortonOrder(queries.points.data(), queries.points.size(), _queryOrder, _queryCodes);
+
+    int nComplete = 0;
+#pragma omp parallel for schedule(static) reduction(+:nComplete) if(parallel)
+    for (int q = 0; q < nQueries; q++) {
+        const int i = ordered ? _queryOrder[q] : q;
+        int *indices = k_indices.data() + size_t(i) * num_closest;
+        float *dists = k_sqr_distances.data() + size_t(i) * num_closest;
+
+        const int nFound = knnSearch(queries.points[i], num_closest, indices, dists);
+        for (int j = nFound; j < num_closest; j++) {
+            indices[j] = -1;
+            dists[j] = std::numeric_limits<float>::max();
+        }
+        if (nFound == num_closest)
+            nComplete++;
+    }
+    return nComplete;
 }
 
 template<typename PointT> inline
@@ -160,7 +239,8 @@ int KdTreeFLANN<PointT>::radiusSearch(const PointT &point, double radius,
     indices_dist.reserve( 128 );
 
     RadiusResultSet<float, int> resultSet(radius, indices_dist);
-    const size_t nFound = _kdtree.findNeighbors(resultSet, point.data, _params);
+    _kdtree.search(point.data, resultSet, _params.eps);
+    const size_t nFound = resultSet.size();
 
     if (_params.sorted)
         std::sort(indices_dist.begin(), indices_dist.end(), IndexDist_Sorter() );
@@ -174,22 +254,6 @@ int KdTreeFLANN<PointT>::radiusSearch(const PointT &point, double radius,
     return nFound;
 }
 
-template<typename PointT> inline
-size_t KdTreeFLANN<PointT>::PointCloud_Adaptor::kdtree_get_point_count() const {
-    if( indices ) return indices->size();
-    if( pcl)  return pcl->points.size();
-    return 0;
-}
-
-template<typename PointT> inline
-float KdTreeFLANN<PointT>::PointCloud_Adaptor::kdtree_get_pt(const size_t idx, int dim) const{
-    const PointT& p = ( indices ) ? pcl->points[(*indices)[idx]] : pcl->points[idx];
-    if (dim==0) return p.x;
-    else if (dim==1) return p.y;
-    else if (dim==2) return p.z;
-    else return 0.0;
-}
-
 }
 
 
@@ -1,6 +1,8 @@
 #include "BasicLaserOdometry.h"
 
 #include "math_utils.h"
+#include <algorithm>
+#include <chrono>
 //#include <pcl/filters/filter.h>
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
@@ -16,6 +18,7 @@ using std::sqrt;
 using std::fabs;
 using std::pow;
 
+const size_t BasicLaserOdometry::BLOCK_SIZE;
 
 BasicLaserOdometry::BasicLaserOdometry(float scanPeriod, size_t maxIterations) :
    _scanPeriod(scanPeriod),
@@ -24,20 +27,86 @@ BasicLaserOdometry::BasicLaserOdometry(float scanPeriod, size_t maxIterations) :
    _maxIterations(maxIterations),
    _deltaTAbort(0.1),
    _deltaRAbort(0.1),
-   _laserCloud(new pcl::PointCloud<pcl::PointXYZI>()),
-   _lastCornerCloud(new pcl::PointCloud<pcl::PointXYZI>()),
-   _lastSurfaceCloud(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudOri(new pcl::PointCloud<pcl::PointXYZI>()),
-   _coeffSel(new pcl::PointCloud<pcl::PointXYZI>())
+   _correspondenceMode(KDTREE_CORRESPONDENCE),
+   _lastIndex(0),
+   _laserCloud(new pcl::PointCloud<PointXYZIRT>())
 {}
 
-void BasicLaserOdometry::transformToGlobal(const pcl::PointCloud<pcl::PointXYZI>& ori, pcl::PointCloud<pcl::PointXYZI>::Ptr& out)
+BasicLaserOdometry::FeatureIndex::FeatureIndex() :
+   cornerCloud(new pcl::PointCloud<PointXYZIRT>()),
+   surfaceCloud(new pcl::PointCloud<PointXYZIRT>()),
+   mode(KDTREE_CORRESPONDENCE),
+   buildTime(0)
+{}
+
+void BasicLaserOdometry::FeatureIndex::build(const CorrespondenceMode& mode)
+{
+   this->mode = mode;
+   if (!isValid())
+   {
+      return;
+   }
+
+   auto buildStart = std::chrono::steady_clock::now();
+   if (mode == PROJECTIVE_CORRESPONDENCE)
+   {
+      cornerImage.setInputCloud(cornerCloud);
+      surfaceImage.setInputCloud(surfaceCloud);
+   }
+   else
+   {
+      cornerKDTree.setInputCloud(cornerCloud);
+      surfaceKDTree.setInputCloud(surfaceCloud);
+      cornerRings.setInputCloud(cornerCloud);
+      surfaceRings.setInputCloud(surfaceCloud);
+   }
+   buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+}
+
+void BasicLaserOdometry::buildNextIndex(pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+                                        pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat)
+{
+   if (_indexBuilt.valid())
+   {
+      _indexBuilt.get();
+   }
+
+   FeatureIndex& next = _featureIndex[1 - _lastIndex];
+   cornerPointsLessSharp.swap(*next.cornerCloud);
+   surfPointsLessFlat.swap(*next.surfaceCloud);
+
+   const CorrespondenceMode mode = _correspondenceMode;
+   _indexBuilt = std::async(std::launch::async, [&next, mode]() { next.build(mode); });
+}
+
+void BasicLaserOdometry::swapIndex()
+{
+   if (!_indexBuilt.valid())
+   {
+      return;
+   }
+
+   auto waitStart = std::chrono::steady_clock::now();
+   _indexBuilt.get();
+   double waitTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+   _lastIndex = 1 - _lastIndex;
+
+#ifdef LOAM_PRINT_STATS
+   const FeatureIndex& last = _featureIndex[_lastIndex];
+   std::cout << "#C last feature index size -> " << last.cornerCloud->points.size() << " / " << last.surfaceCloud->points.size()
+             << ", build time -> " << last.buildTime << " ms, waited -> " << waitTime << " ms" << std::endl;
+#else
+   (void)waitTime;
+#endif
+}
+
+void BasicLaserOdometry::transformToGlobal(const pcl::PointCloud<PointXYZIRT>& ori, pcl::PointCloud<PointXYZIRT>::Ptr& out)
 {
    out->clear();
    for(int i = 0; i < ori.points.size(); i++)
    {
-      pcl::PointXYZI newPoint;
-      pcl::PointXYZI po;
+      PointXYZIRT newPoint;
+      PointXYZIRT po = ori.points[i];
       newPoint.x = ori.points[i].z;
       newPoint.y = ori.points[i].x;
       newPoint.z = ori.points[i].y;
@@ -48,7 +117,6 @@ void BasicLaserOdometry::transformToGlobal(const pcl::PointCloud<pcl::PointXYZI>
       po.x = newPoint.y + cur_pose_estimated.y;
       po.y = newPoint.z + cur_pose_estimated.z;
       po.z = newPoint.x + cur_pose_estimated.x;
-      po.intensity = newPoint.intensity;
       out->points.push_back(po);
    }
  }
@@ -171,56 +239,285 @@ void BasicLaserOdometry::interpolate(const vector<NAVDATA>& data,
 };
 
 
-Eigen::Affine3f BasicLaserOdometry::NAVDATA2Transform(const NAVDATA &nav) {
-   Eigen::Affine3f transform_ = Eigen::Affine3f::Identity();
-   transform_.translation() << nav.x, nav.y, nav.z;
-   transform_.rotate(Eigen::AngleAxisf (nav.roll, Eigen::Vector3f::UnitX()));
-   transform_.rotate(Eigen::AngleAxisf (nav.pitch, Eigen::Vector3f::UnitY()));
-   transform_.rotate(Eigen::AngleAxisf (nav.yaw, Eigen::Vector3f::UnitZ()));
-   return transform_;
+void BasicLaserOdometry::transformToLast(const NAVDATA &last, const NAVDATA &cur, NAVDATA &diff) {
+   Pose transform_local = Pose::fromNav(cur).inverse() * Pose::fromNav(last);
+   transform_local.toNav(diff);
 }
 
-NAVDATA BasicLaserOdometry::Transform2NAVDATA(const Eigen::Affine3f &tranform_) {
-   float x, y, z, roll, pitch, yaw;
-   pcl::getTranslationAndEulerAngles(tranform_,x,y,z,roll,pitch,yaw);
-   NAVDATA nav_;
-   nav_.x = x; nav_.y = y; nav_.z = z; nav_.roll = roll; nav_.pitch = pitch; nav_.yaw = yaw;
-   return nav_;
+void BasicLaserOdometry::transformToGlobal(const NAVDATA &last, const NAVDATA &diff, NAVDATA &cur) {
+   Pose transform_cur = Pose::fromNav(last) * Pose::fromNav(diff).inverse();
+   transform_cur.toNav(cur);
 }
 
-void BasicLaserOdometry::transformToLast(const NAVDATA &last, const NAVDATA &cur, NAVDATA &diff) {
-   Eigen::Affine3f transform_last = NAVDATA2Transform(last);
-   Eigen::Affine3f transform_cur = NAVDATA2Transform(cur);
-   Eigen::Affine3f transform_local = transform_cur.inverse() * transform_last;
-   diff = Transform2NAVDATA(transform_local);
+bool BasicLaserOdometry::cornerCoefficient(const size_t& i, const size_t& iterCount, PointXYZIRT& coeff)
+{
+   const FeatureIndex& last = _featureIndex[_lastIndex];
+   PointXYZIRT pointSel, pointProj, tripod1, tripod2;
+
+   pointSel = _cornerPointsSharp.points[i];
+
+   if (iterCount % 5 == 0)
+   {
+//               pcl::removeNaNFromPointCloud(*_lastCornerCloud, *_lastCornerCloud, indices);
+      int closestPointInd = -1, minPointInd2 = -1;
+      if (last.mode == PROJECTIVE_CORRESPONDENCE)
+      {
+         /* 投影到上一帧特征图像, 在投影像素邻域内查找最近点 */
+         float minPointSqDis = 25;
+         last.cornerImage.nearest(pointSel, pointSel.ring, 2, minPointSqDis, closestPointInd);
+      }
+      else if (_nearestCornerSqDis[i] < 25)
+      {
+         closestPointInd = _nearestCornerInd[i];
+      }
+
+      if (closestPointInd >= 0)
+      {
+         int closestPointScan = last.cornerCloud->points[closestPointInd].ring;
+
+         /* 在相邻扫描线上查找最近点 */
+         float minPointSqDis2 = 25;
+         if (last.mode == PROJECTIVE_CORRESPONDENCE)
+         {
+            last.cornerImage.nearestOnAdjacentRings(pointSel, closestPointScan, 2, minPointSqDis2, minPointInd2);
+         }
+         else
+         {
+            last.cornerRings.nearestOnAdjacentRings(pointSel, closestPointScan, 2, minPointSqDis2, minPointInd2);
+         }
+      }
+
+      _pointSearchCornerInd1[i] = closestPointInd;
+      _pointSearchCornerInd2[i] = minPointInd2;
+   }
+
+   if (_pointSearchCornerInd2[i] >= 0)
+   {
+      tripod1 = last.cornerCloud->points[_pointSearchCornerInd1[i]];
+      tripod2 = last.cornerCloud->points[_pointSearchCornerInd2[i]];
+
+      float x0 = pointSel.x;
+      float y0 = pointSel.y;
+      float z0 = pointSel.z;
+      float x1 = tripod1.x;
+      float y1 = tripod1.y;
+      float z1 = tripod1.z;
+      float x2 = tripod2.x;
+      float y2 = tripod2.y;
+      float z2 = tripod2.z;
+
+      float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                        * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                        + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                        * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                        + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
+                        * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
+
+      float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
+
+      float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                  + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
+
+      float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                   - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+      float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                   + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+      float ld2 = a012 / l12; // Eq. (2)
+
+      // TODO: Why writing to a variable that's never read?
+      pointProj = pointSel;
+      pointProj.x -= la * ld2;
+      pointProj.y -= lb * ld2;
+      pointProj.z -= lc * ld2;
+
+      float s = 1;
+      if (iterCount >= 5)
+      {
+         s = 1 - 1.8f * fabs(ld2);
+      }
+
+      coeff.x = s * la;
+      coeff.y = s * lb;
+      coeff.z = s * lc;
+      coeff.intensity = s * ld2;
+
+      return s > 0.1 && ld2 != 0;
+   }
+
+   return false;
 }
 
-void BasicLaserOdometry::transformToGlobal(const NAVDATA &last, const NAVDATA &diff, NAVDATA &cur) {
-   Eigen::Affine3f transform_last = NAVDATA2Transform(last);
-   Eigen::Affine3f transform_local = NAVDATA2Transform(diff);
-   Eigen::Affine3f transform_cur_inv = transform_local * transform_last.inverse();
-   Eigen::Affine3f transform_cur= transform_cur_inv.inverse();
-   cur = Transform2NAVDATA(transform_cur);
+bool BasicLaserOdometry::surfaceCoefficient(const size_t& i, const size_t& iterCount, PointXYZIRT& coeff)
+{
+   const FeatureIndex& last = _featureIndex[_lastIndex];
+   PointXYZIRT pointSel, pointProj, tripod1, tripod2, tripod3;
+
+   pointSel = _surfPointsFlat.points[i];
+
+   if (iterCount % 5 == 0)
+   {
+      int closestPointInd = -1, minPointInd2 = -1, minPointInd3 = -1;
+      if (last.mode == PROJECTIVE_CORRESPONDENCE)
+      {
+         /* 投影到上一帧特征图像, 在投影像素邻域内查找最近点 */
+         float minPointSqDis = 25;
+         last.surfaceImage.nearest(pointSel, pointSel.ring, 2, minPointSqDis, closestPointInd);
+      }
+      else if (_nearestSurfSqDis[i] < 25)
+      {
+         closestPointInd = _nearestSurfInd[i];
+      }
+
+      if (closestPointInd >= 0)
+      {
+         int closestPointScan = last.surfaceCloud->points[closestPointInd].ring;
+
+         /* 在同一扫描线及相邻扫描线上分别查找最近点 */
+         float minPointSqDis2 = 25, minPointSqDis3 = 25;
+         if (last.mode == PROJECTIVE_CORRESPONDENCE)
+         {
+            last.surfaceImage.nearestOnRing(pointSel, closestPointScan, closestPointInd, minPointSqDis2, minPointInd2);
+            last.surfaceImage.nearestOnAdjacentRings(pointSel, closestPointScan, 2, minPointSqDis3, minPointInd3);
+         }
+         else
+         {
+            last.surfaceRings.nearestOnRing(pointSel, closestPointScan, closestPointInd, minPointSqDis2, minPointInd2);
+            last.surfaceRings.nearestOnAdjacentRings(pointSel, closestPointScan, 2, minPointSqDis3, minPointInd3);
+         }
+      }
+
+      _pointSearchSurfInd1[i] = closestPointInd;
+      _pointSearchSurfInd2[i] = minPointInd2;
+      _pointSearchSurfInd3[i] = minPointInd3;
+   }
+
+   if (_pointSearchSurfInd2[i] >= 0 && _pointSearchSurfInd3[i] >= 0)
+   {
+      tripod1 = last.surfaceCloud->points[_pointSearchSurfInd1[i]];
+      tripod2 = last.surfaceCloud->points[_pointSearchSurfInd2[i]];
+      tripod3 = last.surfaceCloud->points[_pointSearchSurfInd3[i]];
+
+      float pa = (tripod2.y - tripod1.y) * (tripod3.z - tripod1.z)
+         - (tripod3.y - tripod1.y) * (tripod2.z - tripod1.z);
+      float pb = (tripod2.z - tripod1.z) * (tripod3.x - tripod1.x)
+         - (tripod3.z - tripod1.z) * (tripod2.x - tripod1.x);
+      float pc = (tripod2.x - tripod1.x) * (tripod3.y - tripod1.y)
+         - (tripod3.x - tripod1.x) * (tripod2.y - tripod1.y);
+      float pd = -(pa * tripod1.x + pb * tripod1.y + pc * tripod1.z);
+
+      float ps = sqrt(pa * pa + pb * pb + pc * pc);
+      pa /= ps;
+      pb /= ps;
+      pc /= ps;
+      pd /= ps;
+
+      float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd; //Eq. (3)??
+
+      // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
+      pointProj = pointSel;
+      pointProj.x -= pa * pd2;
+      pointProj.y -= pb * pd2;
+      pointProj.z -= pc * pd2;
+
+      float s = 1;
+      if (iterCount >= 5)
+      {
+         s = 1 - 1.8f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
+      }
+
+      coeff.x = s * pa;
+      coeff.y = s * pb;
+      coeff.z = s * pc;
+      coeff.intensity = s * pd2;
+
+      return s > 0.1 && pd2 != 0;
+   }
+
+   return false;
+}
+
+void BasicLaserOdometry::updateJacobian()
+{
+   /* 此处将imu坐标系调整为激光坐标系 */
+   float srx = sin(_transform.roll); // 坐标变换5
+   float crx = cos(_transform.roll);
+   float sry = sin(_transform.pitch);
+   float cry = cos(_transform.pitch);
+   float srz = sin(_transform.yaw);
+   float crz = cos(_transform.yaw);
+
+   _jacobian.dR[0] << -crx*sry*srz, crx*crz*sry, srx*sry,
+                      srx*srz, -crz*srx, crx,
+                      crx*cry*srz, -crx*cry*crz, -cry*srx;
+   _jacobian.dR[1] << -crz*sry - cry*srx*srz, cry*crz*srx - sry*srz, -crx*cry,
+                      0, 0, 0,
+                      cry*crz - srx*sry*srz, cry*srz + crz*srx*sry, -crx*sry;
+   _jacobian.dR[2] << -cry*srz - crz*srx*sry, cry*crz - srx*sry*srz, 0,
+                      -crx*crz, -crx*srz, 0,
+                      cry*crz*srx - sry*srz, crz*sry + cry*srx*srz, 0;
+   _jacobian.origin << _transform.x, _transform.y, _transform.z;
+   _jacobian.dT << -(cry*crz - srx*sry*srz), crx*srz, -(crz*sry + cry*srx*srz),
+                   -(cry*srz + crz*srx*sry), -crx*crz, -(sry*srz - cry*crz*srx),
+                   crx*sry, -srx, -crx*cry;
+}
+
+void BasicLaserOdometry::accumulateBlock(const size_t& block,
+                                         const size_t& iterCount,
+                                         const pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+                                         const pcl::PointCloud<PointXYZIRT>& surfPointsFlat)
+{
+   const size_t cornerPointsSharpNum = cornerPointsSharp.points.size();
+   const size_t pointNum = cornerPointsSharpNum + surfPointsFlat.points.size();
+   const size_t begin = block * BLOCK_SIZE;
+   const size_t end = std::min(begin + BLOCK_SIZE, pointNum);
+
+   NormalEquations& equations = _blockEquations[block];
+   Eigen::Matrix<float, 6, 1> a;
+   PointXYZIRT coeff;
+   equations.setZero();
+
+   for (size_t k = begin; k < end; k++)
+   {
+      bool selected;
+      const PointXYZIRT* pointOri;
+      if (k < cornerPointsSharpNum)
+      {
+         selected = cornerCoefficient(k, iterCount, coeff);
+         pointOri = &cornerPointsSharp.points[k];
+      }
+      else
+      {
+         selected = surfaceCoefficient(k - cornerPointsSharpNum, iterCount, coeff);
+         pointOri = &surfPointsFlat.points[k - cornerPointsSharpNum];
+      }
+
+      if (!selected)
+      {
+         continue;
+      }
+
+      _jacobian.row(pointOri->getVector3fMap(), coeff.getVector3fMap(), a);
+      equations.add(a, -0.05f * coeff.intensity);
+   }
 }
 
 void BasicLaserOdometry::process(const std::vector<NAVDATA>& nav,
                                 const long long& scanTime,
-                                pcl::PointCloud<pcl::PointXYZI>& cornerPointsSharp,
-                                pcl::PointCloud<pcl::PointXYZI>& cornerPointsLessSharp,
-                                pcl::PointCloud<pcl::PointXYZI>& surfPointsLessFlat,
-                                pcl::PointCloud<pcl::PointXYZI>& surfPointsFlat)
+                                pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+                                pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+                                pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+                                pcl::PointCloud<PointXYZIRT>& surfPointsFlat)
 {
    /* cornerPointSharp和surfPointFlat用于遍历特征点优化 */
    /* cornerPointLessSharp和surfPointLessFlat用于初始化KD树 */
+   _solverBudget.start();
 
    /* 如果系统第一次运行, 使用_surfPointLessFlat和_cornerPointLessSharp初始化对应KDTree */
    if (!_systemInited)
    {
-      cornerPointsLessSharp.swap(*_lastCornerCloud);
-      surfPointsLessFlat.swap(*_lastSurfaceCloud);
-
-      _lastCornerKDTree.setInputCloud(_lastCornerCloud);
-      _lastSurfaceKDTree.setInputCloud(_lastSurfaceCloud);
+      buildNextIndex(cornerPointsLessSharp, surfPointsLessFlat);
 
       interpolate(nav,scanTime,_transformSum); /* 原程序中在此处仅适用imu信息中的pich和roll初始化_transformSum */
 
@@ -228,7 +525,6 @@ void BasicLaserOdometry::process(const std::vector<NAVDATA>& nav,
       return;
    }
 
-   pcl::PointXYZI coeff;
    bool isDegenerate = false;
    Eigen::Matrix<float, 6, 6> matP;
 
@@ -237,15 +533,11 @@ void BasicLaserOdometry::process(const std::vector<NAVDATA>& nav,
    interpolate(nav,scanTime,transformGlobal); /* 使用imu位姿信息初始化_transform */
    transformToLast(_transformSum,transformGlobal,_transform); /* 已檢驗: 用全局坐標推相對坐標正確 */
 
-   size_t lastCornerCloudSize = _lastCornerCloud->points.size();
-   size_t lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
+   /* 使用后台构建完成的上一帧KD树 */
+   swapIndex();
 
-   if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100)
+   if (_featureIndex[_lastIndex].isValid())
    {
-      std::vector<int> pointSearchInd(1);
-      std::vector<float> pointSearchSqDis(1);
-      std::vector<int> indices;
-
 //      pcl::removeNaNFromPointCloud(cornerPointsSharp, cornerPointsSharp, indices);
       size_t cornerPointsSharpNum = cornerPointsSharp.points.size();
       size_t surfPointsFlatNum = surfPointsFlat.points.size();
@@ -256,338 +548,59 @@ void BasicLaserOdometry::process(const std::vector<NAVDATA>& nav,
       _pointSearchSurfInd2.resize(surfPointsFlatNum);
       _pointSearchSurfInd3.resize(surfPointsFlatNum);
 
+      const size_t blockNum = (cornerPointsSharpNum + surfPointsFlatNum + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      _blockEquations.resize(blockNum);
+
       std::cout << "#C current frame timestamp -> " << scanTime << std::endl;
       std::cout << "#C cornerPointsSharpNum -> " << cornerPointsSharpNum << std::endl;
       std::cout << "#C surfPointsSharpNum -> " << surfPointsFlatNum << std::endl;
 
+      bool converged = false;
+      float deltaR = 0, deltaT = 0;
       for (size_t iterCount = 0; iterCount < _maxIterations; iterCount++)
       {
-         pcl::PointXYZI pointSel, pointProj, tripod1, tripod2, tripod3;
-                 
-         _laserCloudOri->clear(); /* 用于优化的特征点集 */
-         _coeffSel->clear(); /* 用于优化的参数 */
-         pcl::transformPointCloud(cornerPointsSharp, _cornerPointsSharp, NAVDATA2Transform(_transform));
-         for (int i = 0; i < cornerPointsSharpNum; i++)
+         /* 剩余时间不足以完成下一次迭代时停止, 保留上一次迭代的结果 */
+         if (!_solverBudget.nextIteration())
          {
-            pointSel = _cornerPointsSharp.points[i];
-
-            if (iterCount % 5 == 0)
-            {
-//               pcl::removeNaNFromPointCloud(*_lastCornerCloud, *_lastCornerCloud, indices);
-               _lastCornerKDTree.nearestKSearch(pointSel, 1, pointSearchInd, pointSearchSqDis);
-
-               int closestPointInd = -1, minPointInd2 = -1;
-               if (pointSearchSqDis[0] < 25)
-               {
-                  closestPointInd = pointSearchInd[0];
-                  int closestPointScan = int(_lastCornerCloud->points[closestPointInd].intensity);
-
-                  float pointSqDis, minPointSqDis2 = 25;
-                  for (int j = closestPointInd + 1; j < cornerPointsSharpNum; j++)
-                  {
-                     if (int(_lastCornerCloud->points[j].intensity) > closestPointScan + 2.5)
-                     {
-                        break;
-                     }
-
-                     pointSqDis = calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
-
-                     if (int(_lastCornerCloud->points[j].intensity) > closestPointScan)
-                     {
-                        if (pointSqDis < minPointSqDis2)
-                        {
-                           minPointSqDis2 = pointSqDis;
-                           minPointInd2 = j;
-                        }
-                     }
-                  }
-                  for (int j = closestPointInd - 1; j >= 0; j--)
-                  {
-                     if (int(_lastCornerCloud->points[j].intensity) < closestPointScan - 2.5)
-                     {
-                        break;
-                     }
-
-                     pointSqDis = calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
-
-                     if (int(_lastCornerCloud->points[j].intensity) < closestPointScan)
-                     {
-                        if (pointSqDis < minPointSqDis2)
-                        {
-                           minPointSqDis2 = pointSqDis;
-                           minPointInd2 = j;
-                        }
-                     }
-                  }
-               }
-
-               _pointSearchCornerInd1[i] = closestPointInd;
-               _pointSearchCornerInd2[i] = minPointInd2;
-            }
-
-            if (_pointSearchCornerInd2[i] >= 0)
-            {
-               tripod1 = _lastCornerCloud->points[_pointSearchCornerInd1[i]];
-               tripod2 = _lastCornerCloud->points[_pointSearchCornerInd2[i]];
-
-               float x0 = pointSel.x;
-               float y0 = pointSel.y;
-               float z0 = pointSel.z;
-               float x1 = tripod1.x;
-               float y1 = tripod1.y;
-               float z1 = tripod1.z;
-               float x2 = tripod2.x;
-               float y2 = tripod2.y;
-               float z2 = tripod2.z;
-
-               float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                                 * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                                 + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                                 * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                                 + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
-                                 * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
-
-               float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
-
-               float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                           + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
-
-               float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                            - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-               float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                            + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-               float ld2 = a012 / l12; // Eq. (2)
-
-               // TODO: Why writing to a variable that's never read?
-               pointProj = pointSel;
-               pointProj.x -= la * ld2;
-               pointProj.y -= lb * ld2;
-               pointProj.z -= lc * ld2;
-
-               float s = 1;
-               if (iterCount >= 5)
-               {
-                  s = 1 - 1.8f * fabs(ld2);
-               }
-
-               coeff.x = s * la;
-               coeff.y = s * lb;
-               coeff.z = s * lc;
-               coeff.intensity = s * ld2;
+            break;
+         }
 
-               if (s > 0.1 && ld2 != 0)
-               {
-                  _laserCloudOri->push_back(cornerPointsSharp.points[i]);
-                  _coeffSel->push_back(coeff);
-               }
+         const Pose transform = Pose::fromNav(_transform);
+         transform.transformCloud(cornerPointsSharp, _cornerPointsSharp);
+         transform.transformCloud(surfPointsFlat, _surfPointsFlat);
+         updateJacobian();
 
-            }
+         /* 每5次迭代重新查找一次对应点, 所有特征点的最近邻一次批量并行查询 (投影模式在求残差时直接查找像素邻域) */
+         const FeatureIndex& last = _featureIndex[_lastIndex];
+         if (iterCount % 5 == 0 && last.mode == KDTREE_CORRESPONDENCE)
+         {
+            last.cornerKDTree.nearestKSearch(_cornerPointsSharp, 1, _nearestCornerInd, _nearestCornerSqDis, true);
+            last.surfaceKDTree.nearestKSearch(_surfPointsFlat, 1, _nearestSurfInd, _nearestSurfSqDis, true);
          }
 
-         pcl::transformPointCloud(surfPointsFlat, _surfPointsFlat, NAVDATA2Transform(_transform));
-         for (int i = 0; i < surfPointsFlatNum; i++)
+         /* 特征点按固定大小分块并行求对应点及残差, 各块的部分法方程按块顺序累加, 结果与线程数无关 */
+#pragma omp parallel for schedule(dynamic)
+         for (int block = 0; block < int(blockNum); block++)
          {
-            pointSel = _surfPointsFlat.points[i];
-
-            if (iterCount % 5 == 0)
-            {
-               _lastSurfaceKDTree.nearestKSearch(pointSel, 1, pointSearchInd, pointSearchSqDis);
-               int closestPointInd = -1, minPointInd2 = -1, minPointInd3 = -1;
-               if (pointSearchSqDis[0] < 25)
-               {
-                  closestPointInd = pointSearchInd[0];
-                  int closestPointScan = int(_lastSurfaceCloud->points[closestPointInd].intensity);
-
-                  float pointSqDis, minPointSqDis2 = 25, minPointSqDis3 = 25;
-                  for (int j = closestPointInd + 1; j < surfPointsFlatNum; j++)
-                  {
-                     if (int(_lastSurfaceCloud->points[j].intensity) > closestPointScan + 2.5)
-                     {
-                        break;
-                     }
-
-                     pointSqDis = calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
-
-                     if (int(_lastSurfaceCloud->points[j].intensity) <= closestPointScan)
-                     {
-                        if (pointSqDis < minPointSqDis2)
-                        {
-                           minPointSqDis2 = pointSqDis;
-                           minPointInd2 = j;
-                        }
-                     }
-                     else
-                     {
-                        if (pointSqDis < minPointSqDis3)
-                        {
-                           minPointSqDis3 = pointSqDis;
-                           minPointInd3 = j;
-                        }
-                     }
-                  }
-                  for (int j = closestPointInd - 1; j >= 0; j--)
-                  {
-                     if (int(_lastSurfaceCloud->points[j].intensity) < closestPointScan - 2.5)
-                     {
-                        break;
-                     }
-
-                     pointSqDis = calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
-
-                     if (int(_lastSurfaceCloud->points[j].intensity) >= closestPointScan)
-                     {
-                        if (pointSqDis < minPointSqDis2)
-                        {
-                           minPointSqDis2 = pointSqDis;
-                           minPointInd2 = j;
-                        }
-                     }
-                     else
-                     {
-                        if (pointSqDis < minPointSqDis3)
-                        {
-                           minPointSqDis3 = pointSqDis;
-                           minPointInd3 = j;
-                        }
-                     }
-                  }
-               }
-
-               _pointSearchSurfInd1[i] = closestPointInd;
-               _pointSearchSurfInd2[i] = minPointInd2;
-               _pointSearchSurfInd3[i] = minPointInd3;
-            }
-
-            if (_pointSearchSurfInd2[i] >= 0 && _pointSearchSurfInd3[i] >= 0)
-            {
-               tripod1 = _lastSurfaceCloud->points[_pointSearchSurfInd1[i]];
-               tripod2 = _lastSurfaceCloud->points[_pointSearchSurfInd2[i]];
-               tripod3 = _lastSurfaceCloud->points[_pointSearchSurfInd3[i]];
-
-               float pa = (tripod2.y - tripod1.y) * (tripod3.z - tripod1.z)
-                  - (tripod3.y - tripod1.y) * (tripod2.z - tripod1.z);
-               float pb = (tripod2.z - tripod1.z) * (tripod3.x - tripod1.x)
-                  - (tripod3.z - tripod1.z) * (tripod2.x - tripod1.x);
-               float pc = (tripod2.x - tripod1.x) * (tripod3.y - tripod1.y)
-                  - (tripod3.x - tripod1.x) * (tripod2.y - tripod1.y);
-               float pd = -(pa * tripod1.x + pb * tripod1.y + pc * tripod1.z);
-
-               float ps = sqrt(pa * pa + pb * pb + pc * pc);
-               pa /= ps;
-               pb /= ps;
-               pc /= ps;
-               pd /= ps;
-
-               float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd; //Eq. (3)??
-
-               // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
-               pointProj = pointSel;
-               pointProj.x -= pa * pd2;
-               pointProj.y -= pb * pd2;
-               pointProj.z -= pc * pd2;
-
-               float s = 1;
-               if (iterCount >= 5)
-               {
-                  s = 1 - 1.8f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
-               }
-
-               coeff.x = s * pa;
-               coeff.y = s * pb;
-               coeff.z = s * pc;
-               coeff.intensity = s * pd2;
-
-               if (s > 0.1 && pd2 != 0)
-               {
-                  _laserCloudOri->push_back(surfPointsFlat.points[i]);
-                  _coeffSel->push_back(coeff);
-               }
-            }
+            accumulateBlock(block, iterCount, cornerPointsSharp, surfPointsFlat);
          }
 
-         int pointSelNum = _laserCloudOri->points.size();
-
-          std::cout << "DD _laserCloudOri's size = " << _laserCloudOri->size() << std::endl;
-
-         if (pointSelNum < 10)
+         NormalEquations equations;
+         for (size_t block = 0; block < blockNum; block++)
          {
-            continue;
+            equations += _blockEquations[block];
          }
+         int pointSelNum = equations.size();
 
-         /* 把点云配准和运动估计的问题转换为L-M优化求解的问题 */
-         Eigen::Matrix<float, Eigen::Dynamic, 6> matA(pointSelNum, 6);
-         Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, pointSelNum);
-         Eigen::Matrix<float, 6, 6> matAtA;
-         Eigen::VectorXf matB(pointSelNum);
-         Eigen::Matrix<float, 6, 1> matAtB;
-         Eigen::Matrix<float, 6, 1> matX;
+         std::cout << "DD selected point number = " << pointSelNum << std::endl;
 
-         for (int i = 0; i < pointSelNum; i++)
+         if (pointSelNum < 10)
          {
-            const pcl::PointXYZI& pointOri = _laserCloudOri->points[i];
-            coeff = _coeffSel->points[i];
-
-            float s = 1;
-
-            /* 此处将imu坐标系调整为激光坐标系 */
-            float srx = sin(s * _transform.roll); // 坐标变换5
-            float crx = cos(s * _transform.roll);
-            float sry = sin(s * _transform.pitch);
-            float cry = cos(s * _transform.pitch);
-            float srz = sin(s * _transform.yaw);
-            float crz = cos(s * _transform.yaw);
-            float tx = s * _transform.x;
-            float ty = s * _transform.y;
-            float tz = s * _transform.z;
-
-            float arx = (-s * crx*sry*srz*pointOri.x + s * crx*crz*sry*pointOri.y + s * srx*sry*pointOri.z
-                         + s * tx*crx*sry*srz - s * ty*crx*crz*sry - s * tz*srx*sry) * coeff.x
-               + (s*srx*srz*pointOri.x - s * crz*srx*pointOri.y + s * crx*pointOri.z
-                  + s * ty*crz*srx - s * tz*crx - s * tx*srx*srz) * coeff.y
-               + (s*crx*cry*srz*pointOri.x - s * crx*cry*crz*pointOri.y - s * cry*srx*pointOri.z
-                  + s * tz*cry*srx + s * ty*crx*cry*crz - s * tx*crx*cry*srz) * coeff.z;
-
-            float ary = ((-s * crz*sry - s * cry*srx*srz)*pointOri.x
-                         + (s*cry*crz*srx - s * sry*srz)*pointOri.y - s * crx*cry*pointOri.z
-                         + tx * (s*crz*sry + s * cry*srx*srz) + ty * (s*sry*srz - s * cry*crz*srx)
-                         + s * tz*crx*cry) * coeff.x
-               + ((s*cry*crz - s * srx*sry*srz)*pointOri.x
-                  + (s*cry*srz + s * crz*srx*sry)*pointOri.y - s * crx*sry*pointOri.z
-                  + s * tz*crx*sry - ty * (s*cry*srz + s * crz*srx*sry)
-                  - tx * (s*cry*crz - s * srx*sry*srz)) * coeff.z;
-
-            float arz = ((-s * cry*srz - s * crz*srx*sry)*pointOri.x + (s*cry*crz - s * srx*sry*srz)*pointOri.y
-                         + tx * (s*cry*srz + s * crz*srx*sry) - ty * (s*cry*crz - s * srx*sry*srz)) * coeff.x
-               + (-s * crx*crz*pointOri.x - s * crx*srz*pointOri.y
-                  + s * ty*crx*srz + s * tx*crx*crz) * coeff.y
-               + ((s*cry*crz*srx - s * sry*srz)*pointOri.x + (s*crz*sry + s * cry*srx*srz)*pointOri.y
-                  + tx * (s*sry*srz - s * cry*crz*srx) - ty * (s*crz*sry + s * cry*srx*srz)) * coeff.z;
-
-            float atx = -s * (cry*crz - srx * sry*srz) * coeff.x + s * crx*srz * coeff.y
-               - s * (crz*sry + cry * srx*srz) * coeff.z;
-
-            float aty = -s * (cry*srz + crz * srx*sry) * coeff.x - s * crx*crz * coeff.y
-               - s * (sry*srz - cry * crz*srx) * coeff.z;
-
-            float atz = s * crx*sry * coeff.x - s * srx * coeff.y - s * crx*cry * coeff.z;
-
-            float d2 = coeff.intensity;
-
-            matA(i, 0) = arx;
-            matA(i, 1) = ary;
-            matA(i, 2) = arz;
-            matA(i, 3) = atx;
-            matA(i, 4) = aty;
-            matA(i, 5) = atz;
-            matB(i, 0) = -0.05 * d2;
+            continue;
          }
-         matAt = matA.transpose();
-         matAtA = matAt * matA;
-         matAtB = matAt * matB;
 
-         matX = matAtA.colPivHouseholderQr().solve(matAtB);
+         Eigen::Matrix<float, 6, 6> matAtA = equations.AtA();
+         Eigen::Matrix<float, 6, 1> matX = matAtA.colPivHouseholderQr().solve(equations.AtB());
 
          if (iterCount == 0)
          {
@@ -644,21 +657,29 @@ void BasicLaserOdometry::process(const std::vector<NAVDATA>& nav,
          if (!pcl_isfinite(_transform.z)) _transform.z = 0.0;
          
          // Delta_R + Delta_T
-         float deltaR = sqrt(pow(rad2deg(matX(0, 0)), 2) +
-                             pow(rad2deg(matX(1, 0)), 2) +
-                             pow(rad2deg(matX(2, 0)), 2));
-         float deltaT = sqrt(pow(matX(3, 0) * 100, 2) +
-                             pow(matX(4, 0) * 100, 2) +
-                             pow(matX(5, 0) * 100, 2));
+         deltaR = sqrt(pow(rad2deg(matX(0, 0)), 2) +
+                       pow(rad2deg(matX(1, 0)), 2) +
+                       pow(rad2deg(matX(2, 0)), 2));
+         deltaT = sqrt(pow(matX(3, 0) * 100, 2) +
+                       pow(matX(4, 0) * 100, 2) +
+                       pow(matX(5, 0) * 100, 2));
 
          if (deltaR < _deltaRAbort && deltaT < _deltaTAbort)
          {
+            converged = true;
             break;
          }
 
 //         std::cout << "iterCount -> " << iterCount << ", deltaR -> " << deltaR << ", deltaT -> " << deltaT << std::endl;
 
       } // end of iterations
+
+      _solverBudget.finish(converged, deltaR, deltaT);
+#ifdef LOAM_PRINT_STATS
+      std::cout << "#C solver: ";
+      _solverBudget.print(std::cout);
+      std::cout << std::endl;
+#endif
    } /* for循环终止 */
 
    transformToGlobal(_transformSum, _transform, _transformSum);
@@ -668,18 +689,8 @@ void BasicLaserOdometry::process(const std::vector<NAVDATA>& nav,
    std::cout << "transformSum   - > " << _transformSum.x << ", " << _transformSum.y << ", " << _transformSum.z\
              << ", " <<  _transformSum.roll << ", " << _transform.pitch << ", " << _transform.yaw << std::endl;
 
-   /* 退出前环境保存, 将当前_cornerPointLessSharp及_surfPointLessFlat放入KDTree */
-   cornerPointsLessSharp.swap(*_lastCornerCloud);
-   surfPointsLessFlat.swap(*_lastSurfaceCloud);
-
-   lastCornerCloudSize = _lastCornerCloud->points.size();
-   lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
-
-   if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100)
-   {
-      _lastCornerKDTree.setInputCloud(_lastCornerCloud);
-      _lastSurfaceKDTree.setInputCloud(_lastSurfaceCloud);
-   }
+   /* 退出前环境保存, 将当前_cornerPointLessSharp及_surfPointLessFlat放入KDTree, 在后台构建, 与下一帧的读取及特征提取并行 */
+   buildNextIndex(cornerPointsLessSharp, surfPointsLessFlat);
 
 }
 
@@ -4,8 +4,15 @@
 #include <pcl/point_types.h>
 #include <pcl/common/transforms.h>
 #include <stdio.h>
+#include <future>
 
 #include "Twist.h"
+#include "ProjectiveFeatureStore.h"
+#include "RingFeatureStore.h"
+#include "../ScanRegistration/NormalEquations.h"
+#include "../ScanRegistration/PointTypes.h"
+#include "../ScanRegistration/Pose.h"
+#include "../ScanRegistration/SolverBudget.h"
 #include "../ScanRegistration/time_utils.h"
 #include "./DsvLoading/define.h"
 
@@ -18,17 +25,47 @@ namespace loam
   class BasicLaserOdometry
   {
   public:
+    /** \brief Source of the feature correspondences to the last frame. */
+    enum CorrespondenceMode
+    {
+      KDTREE_CORRESPONDENCE,      ///< nearest neighbors from KD-trees over the last feature clouds
+      PROJECTIVE_CORRESPONDENCE   ///< nearest neighbors from a pixel window of the last feature clouds organized as range images
+    };
+
     explicit BasicLaserOdometry(float scanPeriod = 0.1, size_t maxIterations = 25);
 
     /** \brief Try to process buffered data. */
     void process(const std::vector<NAVDATA>& nav,
             const long long& scanTime,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&);
-
-    size_t transformToEnd(pcl::PointCloud<pcl::PointXYZI>::Ptr& cloud);
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&);
+
+    size_t transformToEnd(pcl::PointCloud<PointXYZIRT>::Ptr& cloud);
+
+    /** \brief Set the wall-clock budget of a frame.
+     *
+     * The optimization stops early with the pose of the last completed iteration if the next iteration would
+     * exceed the budget. The clock starts when process() is called.
+     *
+     * @param budget the budget (in ms, 0 = unlimited)
+     */
+    void setTimeBudget(const double& budget) { _solverBudget.setBudget(budget); }
+
+    /** \brief The frame deadline and the solver statistics. */
+    const SolverBudget& solverBudget() const { return _solverBudget; }
+
+    /** \brief Set the source of the feature correspondences.
+     *
+     * In projective mode the transformed feature points are projected into the last feature clouds organized
+     * by scan ring and azimuth bin, and their line / plane points are picked from the pixels around the
+     * projection. No KD-trees are built or searched. The mode takes effect with the index of the next frame.
+     *
+     * @param mode the correspondence mode
+     */
+    void setCorrespondenceMode(const CorrespondenceMode& mode) { _correspondenceMode = mode; }
+    const CorrespondenceMode& getCorrespondenceMode() const { return _correspondenceMode; }
 
     long long pointcloudTime;
   private:
@@ -40,12 +77,9 @@ namespace loam
     /* 计算当前帧坐标系到全局坐标系的变换 */
     void transformToGlobal(const NAVDATA& last, const NAVDATA& diff, NAVDATA& cur);
 
-    Eigen::Affine3f NAVDATA2Transform(const NAVDATA& nav);
-    NAVDATA Transform2NAVDATA(const Eigen::Affine3f& tranform_);
-
     /* 沿用旧函数名, 将点云投影到上一帧对应坐标系 */
-//    void transformToStart(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
-    void transformToGlobal(const pcl::PointCloud<pcl::PointXYZI>& ori, pcl::PointCloud<pcl::PointXYZI>::Ptr& out);
+//    void transformToStart(const PointXYZIRT& pi, PointXYZIRT& po);
+    void transformToGlobal(const pcl::PointCloud<PointXYZIRT>& ori, pcl::PointCloud<PointXYZIRT>::Ptr& out);
 
     void pluginIMURotation(const Angle& bcx, const Angle& bcy, const Angle& bcz,
                            const Angle& blx, const Angle& bly, const Angle& blz,
@@ -56,6 +90,82 @@ namespace loam
                             Angle lx, Angle ly, Angle lz,
                             Angle &ox, Angle &oy, Angle &oz);
 
+    /** \brief Find the corresponding edge line of a projected sharp corner point and compute its residual coefficients.
+     *
+     * Correspondences are searched every 5th iteration and reused in between. The second line point is the
+     * nearest point on the two rings below or above the ring of the closest point. In projective mode all
+     * candidates come from the pixel window around the projection of the point. Only reads shared state besides
+     * the search index buffers of the point itself, so different points can be processed concurrently.
+     *
+     * @param i the index of the point in the projected sharp corner cloud
+     * @param iterCount the current iteration
+     * @param coeff the output residual coefficients (direction in x, y, z, weighted distance in intensity)
+     * @return true if the point is selected for the optimization, false otherwise
+     */
+    bool cornerCoefficient(const size_t& i, const size_t& iterCount, PointXYZIRT& coeff);
+
+    /** \brief Find the corresponding plane of a projected flat surface point and compute its residual coefficients.
+     *
+     * The second plane point is the nearest other point on the ring of the closest point, the third one the
+     * nearest point on the two rings below or above it.
+     *
+     * @param i the index of the point in the projected flat surface cloud
+     * @param iterCount the current iteration
+     * @param coeff the output residual coefficients (normal in x, y, z, weighted distance in intensity)
+     * @return true if the point is selected for the optimization, false otherwise
+     */
+    bool surfaceCoefficient(const size_t& i, const size_t& iterCount, PointXYZIRT& coeff);
+
+    /** \brief Update the residual Jacobian for the current transform. */
+    void updateJacobian();
+
+    /** \brief Accumulate the partial normal equations of one block of feature points (corner points first, then surface points).
+     *
+     * @param block the block index
+     * @param iterCount the current iteration
+     * @param cornerPointsSharp the sharp corner points of the current frame
+     * @param surfPointsFlat the flat surface points of the current frame
+     */
+    void accumulateBlock(const size_t& block,
+                         const size_t& iterCount,
+                         const pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+                         const pcl::PointCloud<PointXYZIRT>& surfPointsFlat);
+
+    /** \brief Feature clouds of a frame together with their search structures. */
+    struct FeatureIndex
+    {
+      FeatureIndex();
+
+      /** \brief Build the search structures of the given mode (if the clouds contain enough features). */
+      void build(const CorrespondenceMode& mode);
+
+      /** \brief Check if the search structures are built. */
+      bool isValid() const { return cornerCloud->points.size() > 10 && surfaceCloud->points.size() > 100; }
+
+      pcl::PointCloud<PointXYZIRT>::Ptr cornerCloud;    ///< corner points cloud
+      pcl::PointCloud<PointXYZIRT>::Ptr surfaceCloud;   ///< surface points cloud
+      nanoflann::KdTreeFLANN<PointXYZIRT> cornerKDTree;   ///< corner cloud KD-tree
+      nanoflann::KdTreeFLANN<PointXYZIRT> surfaceKDTree;  ///< surface cloud KD-tree
+      RingFeatureStore cornerRings;    ///< corner cloud indexed by scan ring
+      RingFeatureStore surfaceRings;   ///< surface cloud indexed by scan ring
+      ProjectiveFeatureStore cornerImage;    ///< corner cloud organized as range image
+      ProjectiveFeatureStore surfaceImage;   ///< surface cloud organized as range image
+      CorrespondenceMode mode;         ///< mode of the built search structures
+      double buildTime;                ///< duration of the last build (in ms)
+    };
+
+    /** \brief Take over the less sharp / less flat clouds of the current frame and start building their search
+     * structures in the background.
+     *
+     * The structures are built into the buffer that is not used for matching, so matching against the last
+     * frame never waits for the build of the current one.
+     */
+    void buildNextIndex(pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+                        pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat);
+
+    /** \brief Wait for the pending background build (if any) and make its buffer the one used for matching. */
+    void swapIndex();
+
   private:
     float _scanPeriod;       ///< time per scan
     long _frameCount;        ///< number of processed frames
@@ -65,19 +175,26 @@ namespace loam
 
     float _deltaTAbort;     ///< optimization abort threshold for deltaT
     float _deltaRAbort;     ///< optimization abort threshold for deltaR
+    SolverBudget _solverBudget;   ///< per frame deadline and solver statistics
+    CorrespondenceMode _correspondenceMode;   ///< source of the feature correspondences
+
+    static const size_t BLOCK_SIZE = 256;   ///< number of feature points per partial normal equation block
 
-    pcl::PointCloud<pcl::PointXYZI>::Ptr _lastCornerCloud;    ///< last corner points cloud
-    pcl::PointCloud<pcl::PointXYZI>::Ptr _lastSurfaceCloud;   ///< last surface points cloud
+    std::vector<NormalEquations, Eigen::aligned_allocator<NormalEquations>> _blockEquations;  ///< partial normal equations per block
+    PoseJacobian _jacobian;   ///< residual Jacobian for the current transform
 
-    pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudOri;      ///< point selection
-    pcl::PointCloud<pcl::PointXYZI>::Ptr _coeffSel;           ///< point selection coefficients
+    FeatureIndex _featureIndex[2];   ///< double buffered feature index, one for matching, one being built
+    int _lastIndex;                  ///< buffer holding the index of the last frame (used for matching)
+    std::future<void> _indexBuilt;   ///< pending background build (declared after the buffers, so it is joined first on destruction)
 
-    nanoflann::KdTreeFLANN<pcl::PointXYZI> _lastCornerKDTree;   ///< last corner cloud KD-tree
-    nanoflann::KdTreeFLANN<pcl::PointXYZI> _lastSurfaceKDTree;  ///< last surface cloud KD-tree
+    pcl::PointCloud<PointXYZIRT>::Ptr _laserCloud;             ///< full resolution cloud
+    pcl::PointCloud<PointXYZIRT> _cornerPointsSharp; /* 投影到上一幀坐標系中的特徵點雲 */
+    pcl::PointCloud<PointXYZIRT> _surfPointsFlat; /* 投影到上一幀坐標系中的特徵點雲 */
 
-    pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloud;             ///< full resolution cloud
-    pcl::PointCloud<pcl::PointXYZI> _cornerPointsSharp; /* 投影到上一幀坐標系中的特徵點雲 */
-    pcl::PointCloud<pcl::PointXYZI> _surfPointsFlat; /* 投影到上一幀坐標系中的特徵點雲 */
+    std::vector<int> _nearestCornerInd;         ///< batch search result: nearest last corner point per sharp point
+    std::vector<float> _nearestCornerSqDis;     ///< batch search result: squared distance to the nearest last corner point
+    std::vector<int> _nearestSurfInd;           ///< batch search result: nearest last surface point per flat point
+    std::vector<float> _nearestSurfSqDis;       ///< batch search result: squared distance to the nearest last surface point
 
     std::vector<int> _pointSearchCornerInd1;    ///< first corner point search index buffer
     std::vector<int> _pointSearchCornerInd2;    ///< second corner point search index buffer
@@ -21,10 +21,10 @@ namespace loam
 
   void LaserOdometry::process(const std::vector<NAVDATA>& nav,
                               const long long& scanTime,
-                              pcl::PointCloud<pcl::PointXYZI>& _cornerPointsSharp,
-                              pcl::PointCloud<pcl::PointXYZI>& _cornerPointsLessSharp,
-                              pcl::PointCloud<pcl::PointXYZI>& _surfPointsLessFlat,
-                              pcl::PointCloud<pcl::PointXYZI>& _surfPointsFlat)
+                              pcl::PointCloud<PointXYZIRT>& _cornerPointsSharp,
+                              pcl::PointCloud<PointXYZIRT>& _cornerPointsLessSharp,
+                              pcl::PointCloud<PointXYZIRT>& _surfPointsLessFlat,
+                              pcl::PointCloud<PointXYZIRT>& _surfPointsFlat)
   {
     BasicLaserOdometry::process(nav, scanTime, _cornerPointsSharp, _cornerPointsLessSharp, _surfPointsLessFlat, _surfPointsFlat);
   }
@@ -20,10 +20,10 @@ namespace loam
 
     void process(const std::vector<NAVDATA>& nav,
             const long long& scanTime,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&);
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&);
 
   private:
     uint16_t _ioRatio;       ///< ratio of input to output frames
@@ -0,0 +1,128 @@
+#include "ProjectiveFeatureStore.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace loam
+{
+
+ProjectiveFeatureStore::ProjectiveFeatureStore(const int& nCols, const int& colRange) :
+   _nCols(std::max(nCols, 1)),
+   _colRange(std::min(std::max(colRange, 0), (std::max(nCols, 1) - 1) / 2)),
+   _nRings(0)
+{}
+
+int ProjectiveFeatureStore::column(const PointXYZIRT& point) const
+{
+   const float angle = std::atan2(point.y, point.x) + float(M_PI);   // [0, 2 * pi]
+   const int col = int(angle * (_nCols / (2 * M_PI)));
+   return col >= _nCols ? col - _nCols : col;
+}
+
+void ProjectiveFeatureStore::setInputCloud(const pcl::PointCloud<PointXYZIRT>::Ptr& cloud)
+{
+   _cloud = cloud;
+
+   _nRings = 0;
+   for (const PointXYZIRT& p : cloud->points)
+   {
+      if (p.ring >= _nRings)
+      {
+         _nRings = p.ring + 1;
+      }
+   }
+
+   /* 按像素计数排序, 每个像素的点在_pixelPoints中连续存放 */
+   const size_t nPixels = size_t(_nRings) * _nCols;
+   const size_t nPoints = cloud->points.size();
+   _pixelStart.assign(nPixels + 1, 0);
+   _pointPixel.resize(nPoints);
+   for (size_t i = 0; i < nPoints; i++)
+   {
+      const PointXYZIRT& p = cloud->points[i];
+      _pointPixel[i] = p.ring * _nCols + column(p);
+      _pixelStart[_pointPixel[i] + 1]++;
+   }
+   for (size_t pixel = 0; pixel < nPixels; pixel++)
+   {
+      _pixelStart[pixel + 1] += _pixelStart[pixel];
+   }
+
+   _pixelPoints.resize(nPoints);
+   for (size_t i = 0; i < nPoints; i++)
+   {
+      // the pixel start serves as insert position
+      _pixelPoints[_pixelStart[_pointPixel[i]]++] = int(i);
+   }
+   // the insert positions moved each pixel start to the start of the next pixel
+   for (size_t pixel = nPixels; pixel > 0; pixel--)
+   {
+      _pixelStart[pixel] = _pixelStart[pixel - 1];
+   }
+   _pixelStart[0] = 0;
+}
+
+void ProjectiveFeatureStore::searchWindow(const PointXYZIRT& point, const int& ring, const int& col,
+                                          const int& excludeIdx, float& minSqDis, int& minIdx) const
+{
+   if (ring < 0 || ring >= _nRings)
+   {
+      return;
+   }
+
+   const int rowStart = ring * _nCols;
+   for (int c = col - _colRange; c <= col + _colRange; c++)
+   {
+      const int pixel = rowStart + (c < 0 ? c + _nCols : (c >= _nCols ? c - _nCols : c));
+      for (int k = _pixelStart[pixel]; k < _pixelStart[pixel + 1]; k++)
+      {
+         const int idx = _pixelPoints[k];
+         if (idx == excludeIdx)
+         {
+            continue;
+         }
+
+         const PointXYZIRT& p = _cloud->points[idx];
+         const float dx = p.x - point.x;
+         const float dy = p.y - point.y;
+         const float dz = p.z - point.z;
+         const float sqDis = dx * dx + dy * dy + dz * dz;
+         if (sqDis < minSqDis)
+         {
+            minSqDis = sqDis;
+            minIdx = idx;
+         }
+      }
+   }
+}
+
+void ProjectiveFeatureStore::nearestOnRing(const PointXYZIRT& point, const int& ring, const int& excludeIdx,
+                                           float& minSqDis, int& minIdx) const
+{
+   searchWindow(point, ring, column(point), excludeIdx, minSqDis, minIdx);
+}
+
+void ProjectiveFeatureStore::nearestOnAdjacentRings(const PointXYZIRT& point, const int& ring, const int& ringRange,
+                                                    float& minSqDis, int& minIdx) const
+{
+   const int col = column(point);
+   for (int r = ring - ringRange; r <= ring + ringRange; r++)
+   {
+      if (r != ring)
+      {
+         searchWindow(point, r, col, -1, minSqDis, minIdx);
+      }
+   }
+}
+
+void ProjectiveFeatureStore::nearest(const PointXYZIRT& point, const int& ring, const int& ringRange,
+                                     float& minSqDis, int& minIdx) const
+{
+   const int col = column(point);
+   for (int r = ring - ringRange; r <= ring + ringRange; r++)
+   {
+      searchWindow(point, r, col, -1, minSqDis, minIdx);
+   }
+}
+
+} // end namespace loam
@@ -0,0 +1,98 @@
+#ifndef LOAM_PROJECTIVEFEATURESTORE_H
+#define LOAM_PROJECTIVEFEATURESTORE_H
+
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "../ScanRegistration/PointTypes.h"
+
+namespace loam
+{
+
+  /** \brief Feature cloud of the last frame, organized as a range image of scan rings and azimuth bins.
+   *
+   * The points are bucketed by their ring and the azimuth bin of their horizontal angle. A query point is
+   * projected into the image and its candidate neighbors are the points of the pixels in a small window around
+   * the projection, so every lookup is constant time and no tree is built or searched. The window spans
+   * +/- colRange azimuth bins; correspondences outside of it are not found, which bounds the supported
+   * rotation between two frames. All returned indices refer to the full input cloud. Searches are const and do
+   * not share buffers, so they can be run concurrently.
+   */
+  class ProjectiveFeatureStore
+  {
+  public:
+    /** \brief Construct a new store.
+     *
+     * @param nCols the number of azimuth bins of a full revolution
+     * @param colRange the number of neighboring azimuth bins searched on each side of a projected point
+     */
+    explicit ProjectiveFeatureStore(const int& nCols = 720, const int& colRange = 4);
+
+    /** \brief Organize the given cloud by its scan rings and azimuth bins.
+     *
+     * The cloud is referenced, not copied, and must not be modified while the store is in use. The pixel
+     * buffers are kept between calls.
+     *
+     * @param cloud the feature cloud
+     */
+    void setInputCloud(const pcl::PointCloud<PointXYZIRT>::Ptr& cloud);
+
+    /** \brief Find the nearest point within the window around the projection of a point on a scan ring.
+     *
+     * @param point the query point
+     * @param ring the scan ring to search
+     * @param excludeIdx the cloud index of a point to ignore (-1 = none)
+     * @param minSqDis the squared distance bound, updated if a closer point is found
+     * @param minIdx the cloud index of the closest point found so far, updated if a closer point is found
+     */
+    void nearestOnRing(const PointXYZIRT& point, const int& ring, const int& excludeIdx,
+                       float& minSqDis, int& minIdx) const;
+
+    /** \brief Find the nearest point within the window around the projection of a point on the rings within
+     * [ring - ringRange, ring + ringRange], excluding the ring itself.
+     *
+     * @param point the query point
+     * @param ring the center scan ring
+     * @param ringRange the number of neighboring rings on each side
+     * @param minSqDis the squared distance bound, updated if a closer point is found
+     * @param minIdx the cloud index of the closest point found so far, updated if a closer point is found
+     */
+    void nearestOnAdjacentRings(const PointXYZIRT& point, const int& ring, const int& ringRange,
+                                float& minSqDis, int& minIdx) const;
+
+    /** \brief Find the nearest point within the window around the projection of a point on the rings within
+     * [ring - ringRange, ring + ringRange], including the ring itself.
+     *
+     * @param point the query point
+     * @param ring the center scan ring
+     * @param ringRange the number of neighboring rings on each side
+     * @param minSqDis the squared distance bound, updated if a closer point is found
+     * @param minIdx the cloud index of the closest point found so far, updated if a closer point is found
+     */
+    void nearest(const PointXYZIRT& point, const int& ring, const int& ringRange,
+                 float& minSqDis, int& minIdx) const;
+
+    int numberOfRings() const { return _nRings; }
+
+  private:
+    /** \brief The azimuth bin of a point. */
+    int column(const PointXYZIRT& point) const;
+
+    /** \brief Search the window around a column on a scan ring. */
+    void searchWindow(const PointXYZIRT& point, const int& ring, const int& col, const int& excludeIdx,
+                      float& minSqDis, int& minIdx) const;
+
+    int _nCols;     ///< number of azimuth bins
+    int _colRange;  ///< number of searched azimuth bins on each side
+    int _nRings;    ///< number of scan rings
+
+    pcl::PointCloud<PointXYZIRT>::Ptr _cloud;   ///< indexed cloud
+    std::vector<int> _pixelStart;               ///< start of the points of every pixel (ring major) in _pixelPoints, plus end marker
+    std::vector<int> _pixelPoints;              ///< cloud indices of the points, ordered by pixel
+    std::vector<int> _pointPixel;               ///< pixel of every cloud point
+  };
+
+} // end namespace loam
+
+#endif //LOAM_PROJECTIVEFEATURESTORE_H
@@ -0,0 +1,85 @@
+#include "RingFeatureStore.h"
+
+namespace loam
+{
+
+void RingFeatureStore::setInputCloud(const pcl::PointCloud<PointXYZIRT>::Ptr& cloud)
+{
+   int nRings = 0;
+   for (const PointXYZIRT& p : cloud->points)
+   {
+      if (p.ring >= nRings)
+      {
+         nRings = p.ring + 1;
+      }
+   }
+
+   while (int(_ringIndices.size()) < nRings)
+   {
+      _ringIndices.push_back(boost::shared_ptr<std::vector<int> >(new std::vector<int>()));
+      _ringTrees.push_back(RingTree::Ptr(new RingTree()));
+   }
+   _ringIndices.resize(nRings);
+   _ringTrees.resize(nRings);
+
+   for (int ring = 0; ring < nRings; ring++)
+   {
+      _ringIndices[ring]->clear();
+   }
+   for (size_t i = 0; i < cloud->points.size(); i++)
+   {
+      _ringIndices[cloud->points[i].ring]->push_back(int(i));
+   }
+
+   for (int ring = 0; ring < nRings; ring++)
+   {
+      if (!_ringIndices[ring]->empty())
+      {
+         _ringTrees[ring]->setInputCloud(cloud, _ringIndices[ring]);
+      }
+   }
+}
+
+void RingFeatureStore::nearestOnRing(const PointXYZIRT& point, const int& ring, const int& excludeIdx,
+                                     float& minSqDis, int& minIdx) const
+{
+   if (ring < 0 || ring >= numberOfRings() || _ringIndices[ring]->empty())
+   {
+      return;
+   }
+
+   // the excluded point is usually the nearest one, so search for one more
+   int pointSearchInd[2];
+   float pointSearchSqDis[2];
+   const std::vector<int>& indices = *_ringIndices[ring];
+   int nFound = _ringTrees[ring]->knnSearch(point, excludeIdx < 0 ? 1 : 2, pointSearchInd, pointSearchSqDis);
+
+   for (int k = 0; k < nFound; k++)
+   {
+      int cloudIdx = indices[pointSearchInd[k]];
+      if (cloudIdx == excludeIdx)
+      {
+         continue;
+      }
+      if (pointSearchSqDis[k] < minSqDis)
+      {
+         minSqDis = pointSearchSqDis[k];
+         minIdx = cloudIdx;
+      }
+      break;
+   }
+}
+
+void RingFeatureStore::nearestOnAdjacentRings(const PointXYZIRT& point, const int& ring, const int& ringRange,
+                                              float& minSqDis, int& minIdx) const
+{
+   for (int r = ring - ringRange; r <= ring + ringRange; r++)
+   {
+      if (r != ring)
+      {
+         nearestOnRing(point, r, -1, minSqDis, minIdx);
+      }
+   }
+}
+
+} // end namespace loam
@@ -0,0 +1,66 @@
+#ifndef LOAM_RINGFEATURESTORE_H
+#define LOAM_RINGFEATURESTORE_H
+
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "nanoflann_pcl.h"
+#include "../ScanRegistration/PointTypes.h"
+
+namespace loam
+{
+
+  /** \brief Feature cloud of the last frame, indexed by scan ring.
+   *
+   * Every ring gets its own KD-tree over the indices of its points, so the nearest point on a given ring is
+   * found in logarithmic time instead of by walking the ring sorted cloud. The points do not need to be sorted
+   * by ring. All returned indices refer to the full input cloud. Searches are const and do not share buffers,
+   * so they can be run concurrently.
+   */
+  class RingFeatureStore
+  {
+  public:
+    /** \brief Index the given cloud by its scan rings.
+     *
+     * The cloud is referenced, not copied, and must not be modified while the store is in use. Ring trees
+     * are kept between calls and only rebuilt.
+     *
+     * @param cloud the feature cloud
+     */
+    void setInputCloud(const pcl::PointCloud<PointXYZIRT>::Ptr& cloud);
+
+    /** \brief Find the nearest point on a scan ring.
+     *
+     * @param point the query point
+     * @param ring the scan ring to search
+     * @param excludeIdx the cloud index of a point to ignore (-1 = none)
+     * @param minSqDis the squared distance bound, updated if a closer point is found
+     * @param minIdx the cloud index of the closest point found so far, updated if a closer point is found
+     */
+    void nearestOnRing(const PointXYZIRT& point, const int& ring, const int& excludeIdx,
+                       float& minSqDis, int& minIdx) const;
+
+    /** \brief Find the nearest point on the rings within [ring - ringRange, ring + ringRange], excluding the ring itself.
+     *
+     * @param point the query point
+     * @param ring the center scan ring
+     * @param ringRange the number of neighboring rings on each side
+     * @param minSqDis the squared distance bound, updated if a closer point is found
+     * @param minIdx the cloud index of the closest point found so far, updated if a closer point is found
+     */
+    void nearestOnAdjacentRings(const PointXYZIRT& point, const int& ring, const int& ringRange,
+                                float& minSqDis, int& minIdx) const;
+
+    int numberOfRings() const { return int(_ringIndices.size()); }
+
+  private:
+    typedef nanoflann::KdTreeFLANN<PointXYZIRT> RingTree;
+
+    std::vector<boost::shared_ptr<std::vector<int> > > _ringIndices;   ///< cloud indices of the points per ring
+    std::vector<RingTree::Ptr> _ringTrees;                             ///< KD-tree over the ring indices per ring
+  };
+
+} // end namespace loam
+
+#endif //LOAM_RINGFEATURESTORE_H
@@ -11,29 +11,35 @@ namespace loam {
 
 /** \brief Class for holding an angle.
  *
- * This class provides buffered access to sine and cosine values to the represented angular value.
+ * This class provides buffered access to sine and cosine values to the represented angular value. The values are
+ * calculated on first access, so angles that are only added up or compared do not pay for them. The lazy
+ * update is not synchronized, so a single angle must not be read from several threads before its first access.
  */
 class Angle {
 public:
   Angle()
       : _radian(0.0),
         _cos(1.0),
-        _sin(0.0) {}
+        _sin(0.0),
+        _cached(true) {}
 
   Angle(float radValue)
       : _radian(radValue),
-        _cos(std::cos(radValue)),
-        _sin(std::sin(radValue)) {}
+        _cos(1.0),
+        _sin(0.0),
+        _cached(false) {}
 
   Angle(const Angle &other)
       : _radian(other._radian),
         _cos(other._cos),
-        _sin(other._sin) {}
+        _sin(other._sin),
+        _cached(other._cached) {}
 
   void operator=(const Angle &rhs) {
     _radian = (rhs._radian);
     _cos = (rhs._cos);
     _sin = (rhs._sin);
+    _cached = (rhs._cached);
   }
 
   void operator+=(const float &radValue) { *this = (_radian + radValue); }
@@ -49,6 +55,7 @@ public:
     out._radian = -_radian;
     out._cos = _cos;
     out._sin = -(_sin);
+    out._cached = _cached;
     return out;
   }
 
@@ -56,14 +63,23 @@ public:
 
   float deg() const { return float(_radian * 180 / M_PI); }
 
-  float cos() const { return _cos; }
+  float cos() const { updateCache(); return _cos; }
 
-  float sin() const { return _sin; }
+  float sin() const { updateCache(); return _sin; }
 
 private:
-  float _radian;    ///< angle value in radian
-  float _cos;       ///< cosine of the angle
-  float _sin;       ///< sine of the angle
+  void updateCache() const {
+    if (!_cached) {
+      _cos = std::cos(_radian);
+      _sin = std::sin(_radian);
+      _cached = true;
+    }
+  }
+
+  float _radian;          ///< angle value in radian
+  mutable float _cos;     ///< cosine of the angle
+  mutable float _sin;     ///< sine of the angle
+  mutable bool _cached;   ///< true if the sine and cosine are up to date
 };
 
 } // end namespace loam
@@ -1,4 +1,4 @@
-#include <pcl/filters/voxel_grid.h>
+#include <algorithm>
 
 #include "BasicScanRegistration.h"
 #include "math_utils.h"
@@ -13,7 +13,8 @@ RegistrationParams::RegistrationParams(const float& scanPeriod_,
                                        const int& maxCornerSharp_,
                                        const int& maxSurfaceFlat_,
                                        const float& lessFlatFilterSize_,
-                                       const float& surfaceCurvatureThreshold_)
+                                       const float& surfaceCurvatureThreshold_,
+                                       const int& maxSurfaceLessFlat_)
     : scanPeriod(scanPeriod_),
       imuHistorySize(imuHistorySize_),
       nFeatureRegions(nFeatureRegions_),
@@ -22,18 +23,40 @@ RegistrationParams::RegistrationParams(const float& scanPeriod_,
       maxCornerLessSharp(10 * maxCornerSharp_),
       maxSurfaceFlat(maxSurfaceFlat_),
       lessFlatFilterSize(lessFlatFilterSize_),
-      surfaceCurvatureThreshold(surfaceCurvatureThreshold_)
+      surfaceCurvatureThreshold(surfaceCurvatureThreshold_),
+      maxSurfaceLessFlat(maxSurfaceLessFlat_)
 {};
 
+BasicScanRegistration::BasicScanRegistration()
+{
+  configure();
+}
+
+bool BasicScanRegistration::configure(const RegistrationParams& config)
+{
+  _config = config;
+  return selectCurvatureKernel(_config.curvatureRegion, _curvatureKernel, _markAsPickedKernel);
+}
+
 void BasicScanRegistration::processScanlines(const long long& scanTime,
-        std::vector<pcl::PointCloud<pcl::PointXYZI>> const& laserCloudScans,
-        pcl::PointCloud<pcl::PointXYZI>& cornerPointsSharp,
-        pcl::PointCloud<pcl::PointXYZI>& cornerPointsLessSharp,
-        pcl::PointCloud<pcl::PointXYZI>& surfPointsLessFlat,
-        pcl::PointCloud<pcl::PointXYZI>& surfPointsFlat)
+        std::vector<pcl::PointCloud<PointXYZIRT>> const& laserCloudScans,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+        pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+        pcl::PointCloud<PointXYZIRT>& surfPointsFlat)
 {
+  // clear buffers of the previous sweep, keeping their capacity for reuse
+  reset(Time(std::chrono::milliseconds(scanTime)));
+
   // construct sorted full resolution cloud
   size_t cloudSize = 0;
+  for (int i = 0; i < laserCloudScans.size(); i++) {
+    cloudSize += laserCloudScans[i].size();
+  }
+  _laserCloud.reserve(cloudSize);
+  _scanIndices.reserve(laserCloudScans.size());
+
+  cloudSize = 0;
   for (int i = 0; i < laserCloudScans.size(); i++) {
     _laserCloud += laserCloudScans[i];
     IndexRange range(cloudSize, 0);
@@ -41,13 +64,143 @@ void BasicScanRegistration::processScanlines(const long long& scanTime,
     range.second = cloudSize > 0 ? cloudSize - 1 : 0; /* 使用range存储每根激光线起始和终止激光点的索引 */
     _scanIndices.push_back(range);
   }
+  _laserCloudSoA.assign(_laserCloud);
 
   extractFeatures();
 //  updateIMUTransform();
 
   cornerPointsSharp = _cornerPointsSharp;
   cornerPointsLessSharp = _cornerPointsLessSharp;
-  surfPointsLessFlat = _laserCloud; // _surfacePointsLessFlat; //TODO: 将传回值从_laserCloud改回_surfacePointsLessFlat
+  surfPointsLessFlat = _surfacePointsLessFlat;
+  surfPointsFlat = _surfacePointsFlat;
+}
+
+void BasicScanRegistration::beginSweep(const long long& scanTime, const int& nSectors)
+{
+  reset(Time(std::chrono::milliseconds(scanTime)));
+
+  _sweepSectors = nSectors > 0 ? nSectors : 1;
+  for (auto& scan : _sweepScans) {
+    scan.clear();
+  }
+  _sweepScanDone.assign(_sweepScans.size(), 0);
+}
+
+void BasicScanRegistration::processSectorScanlines(std::vector<pcl::PointCloud<PointXYZIRT>> const& sectorScans,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+        pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+        pcl::PointCloud<PointXYZIRT>& surfPointsFlat)
+{
+  if (_sweepScans.size() < sectorScans.size()) {
+    _sweepScans.resize(sectorScans.size());
+    _sweepScanDone.resize(sectorScans.size(), 0);
+  }
+
+  // clear the buffers of the previous sector
+  _laserCloud.clear();
+  _scanIndices.clear();
+  _cornerPointsSharp.clear();
+  _cornerPointsLessSharp.clear();
+  _surfacePointsFlat.clear();
+  _surfacePointsLessFlat.clear();
+
+  // append the sector to the scan rings and collect the ring chunks with a complete curvature region,
+  // including curvatureRegion points of context on both sides
+  const size_t curvatureRegion = _config.curvatureRegion;
+  for (size_t i = 0; i < sectorScans.size(); i++) {
+    pcl::PointCloud<PointXYZIRT>& scan = _sweepScans[i];
+    scan += sectorScans[i];
+
+    size_t chunkStart = std::max(_sweepScanDone[i], curvatureRegion);
+    if (scan.size() < chunkStart + 2 * curvatureRegion + 1) {
+      continue;
+    }
+    size_t chunkEnd = scan.size() - curvatureRegion;
+
+    IndexRange range(_laserCloud.size(), 0);
+    _laserCloud.points.insert(_laserCloud.points.end(),
+                              scan.points.begin() + (chunkStart - curvatureRegion),
+                              scan.points.begin() + (chunkEnd + curvatureRegion));
+    range.second = _laserCloud.size() - 1;
+    _scanIndices.push_back(range);
+
+    // the last feature region of a scan ends one point before its trailing context
+    _sweepScanDone[i] = chunkEnd - 1;
+  }
+  _laserCloud.width = _laserCloud.points.size();
+  _laserCloud.height = 1;
+  _laserCloudSoA.assign(_laserCloud);
+
+  extractFeatures(0, std::max(1, _config.nFeatureRegions / _sweepSectors));
+
+  cornerPointsSharp = _cornerPointsSharp;
+  cornerPointsLessSharp = _cornerPointsLessSharp;
+  surfPointsLessFlat = _surfacePointsLessFlat;
+  surfPointsFlat = _surfacePointsFlat;
+}
+
+void BasicScanRegistration::endSweep(pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+        pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+        pcl::PointCloud<PointXYZIRT>& surfPointsFlat)
+{
+  _laserCloud.clear();
+  _scanIndices.clear();
+  _cornerPointsSharp.clear();
+  _cornerPointsLessSharp.clear();
+  _surfacePointsFlat.clear();
+  _surfacePointsLessFlat.clear();
+
+  // a ring closes on itself after a full sweep: its held back tail and its first curvatureRegion points (so far
+  // only context) are extracted in one chunk, with the points before the tail and after the head as context
+  const size_t curvatureRegion = _config.curvatureRegion;
+  for (size_t i = 0; i < _sweepScans.size(); i++) {
+    const pcl::PointCloud<PointXYZIRT>& scan = _sweepScans[i];
+    const size_t tailStart = std::max(_sweepScanDone[i], curvatureRegion);
+
+    // skip rings too short to wrap without overlap
+    if (tailStart < 3 * curvatureRegion + 1 || scan.size() <= tailStart) {
+      continue;
+    }
+
+    IndexRange range(_laserCloud.size(), 0);
+    _laserCloud.points.insert(_laserCloud.points.end(),
+                              scan.points.begin() + (tailStart - curvatureRegion), scan.points.end());
+    _laserCloud.points.insert(_laserCloud.points.end(),
+                              scan.points.begin(), scan.points.begin() + (2 * curvatureRegion + 1));
+    range.second = _laserCloud.size() - 1;
+    _scanIndices.push_back(range);
+
+    _sweepScanDone[i] = scan.size();
+  }
+  _laserCloud.width = _laserCloud.points.size();
+  _laserCloud.height = 1;
+  _laserCloudSoA.assign(_laserCloud);
+
+  extractFeatures(0, 1);
+
+  cornerPointsSharp = _cornerPointsSharp;
+  cornerPointsLessSharp = _cornerPointsLessSharp;
+  surfPointsLessFlat = _surfacePointsLessFlat;
+  surfPointsFlat = _surfacePointsFlat;
+}
+
+void BasicScanRegistration::processRangeImage(const long long& scanTime,
+        const RangeImage& image,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+        pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+        pcl::PointCloud<PointXYZIRT>& surfPointsFlat)
+{
+  // clear buffers of the previous sweep, keeping their capacity for reuse
+  reset(Time(std::chrono::milliseconds(scanTime)));
+
+  extractFeatures(image);
+
+  cornerPointsSharp = _cornerPointsSharp;
+  cornerPointsLessSharp = _cornerPointsLessSharp;
+  surfPointsLessFlat = _surfacePointsLessFlat;
   surfPointsFlat = _surfacePointsFlat;
 }
 
@@ -78,7 +231,7 @@ void BasicScanRegistration::reset(const Time& scanTime)
   }
 }
 
-void BasicScanRegistration::projectPointToStartOfSweep(pcl::PointXYZI& point, float relTime)
+void BasicScanRegistration::projectPointToStartOfSweep(PointXYZIRT& point, float relTime)
 {
   // project point to the start of the sweep using corresponding IMU data
   if (hasIMUData())
@@ -96,7 +249,7 @@ void BasicScanRegistration::setIMUTransformFor(const float& relTime)
   _imuPositionShift = _imuCur.position - _imuStart.position - _imuStart.velocity * relSweepTime;
 }
 
-void BasicScanRegistration::transformToStartIMU(pcl::PointXYZI& point)
+void BasicScanRegistration::transformToStartIMU(PointXYZIRT& point)
 {
   // rotate point to global IMU system
   rotateZXY(point, _imuCur.roll, _imuCur.pitch, _imuCur.yaw);
@@ -126,12 +279,18 @@ void BasicScanRegistration::interpolateIMUStateFor(const float &relTime, IMUStat
   }
 }
 
-void BasicScanRegistration::extractFeatures(const uint16_t& beginIdx)
+void BasicScanRegistration::extractFeatures(const uint16_t& beginIdx, const int& nRegions)
 {
+  _lessFlatFilter.setLeafSize(_config.lessFlatFilterSize);
+
+  // scale the feature regions and the less flat budget to partial scans
+  const int nFeatureRegions = nRegions > 0 ? nRegions : _config.nFeatureRegions;
+  const size_t maxLessFlatNum = size_t(_config.maxSurfaceLessFlat) * nFeatureRegions / _config.nFeatureRegions;
+
   // extract features from individual scans
   size_t nScans = _scanIndices.size();
   for (size_t i = beginIdx; i < nScans; i++) {
-//    pcl::PointCloud<pcl::PointXYZI>::Ptr surfPointsLessFlatScan(new pcl::PointCloud<pcl::PointXYZI>);
+    _surfPointsLessFlatScan.clear();
     size_t scanStartIdx = _scanIndices[i].first;
     size_t scanEndIdx = _scanIndices[i].second;
 
@@ -144,11 +303,11 @@ void BasicScanRegistration::extractFeatures(const uint16_t& beginIdx)
     setScanBuffersFor(scanStartIdx, scanEndIdx);
 
     // extract features from equally sized scan regions
-    for (int j = 0; j < _config.nFeatureRegions; j++) {
-      size_t sp = ((scanStartIdx + _config.curvatureRegion) * (_config.nFeatureRegions - j)
-                   + (scanEndIdx - _config.curvatureRegion) * j) / _config.nFeatureRegions;
-      size_t ep = ((scanStartIdx + _config.curvatureRegion) * (_config.nFeatureRegions - 1 - j)
-                   + (scanEndIdx - _config.curvatureRegion) * (j + 1)) / _config.nFeatureRegions - 1;
+    for (int j = 0; j < nFeatureRegions; j++) {
+      size_t sp = ((scanStartIdx + _config.curvatureRegion) * (nFeatureRegions - j)
+                   + (scanEndIdx - _config.curvatureRegion) * j) / nFeatureRegions;
+      size_t ep = ((scanStartIdx + _config.curvatureRegion) * (nFeatureRegions - 1 - j)
+                   + (scanEndIdx - _config.curvatureRegion) * (j + 1)) / nFeatureRegions - 1;
 
       // skip empty regions
       if (ep <= sp) {
@@ -204,20 +363,134 @@ void BasicScanRegistration::extractFeatures(const uint16_t& beginIdx)
       // extract less flat surface features
       for (int k = 0; k < regionSize; k++) {
         if (_regionLabel[k] <= SURFACE_LESS_FLAT) {
-          _surfacePointsLessFlat.push_back(_laserCloud[sp + k]);
+          _surfPointsLessFlatScan.push_back(_laserCloud[sp + k]);
+        }
+      }
+    }
+
+    appendLessFlatScan(maxLessFlatNum);
+  }
+}
+
+void BasicScanRegistration::extractFeatures(const RangeImage& image)
+{
+  _lessFlatFilter.setLeafSize(_config.lessFlatFilterSize);
+
+  const int cols = image.cols;
+  const int curvatureRegion = _config.curvatureRegion;
+
+  // skip images too narrow for a single curvature region
+  if (cols <= 2 * curvatureRegion + 1) {
+    return;
+  }
+
+  // extract features from individual scan rings (image rows)
+  const int nScans = image.numberOfScanRings();
+  PointXYZIRT point;
+  for (int scanID = 0; scanID < nScans; scanID++) {
+    _surfPointsLessFlatScan.clear();
+    const int row = scanID * image.rowStep;
+
+    setRowBuffersFor(image, row);
+
+    // extract features from equally sized column regions
+    for (int j = 0; j < _config.nFeatureRegions; j++) {
+      int sp = (curvatureRegion * (_config.nFeatureRegions - j)
+                + (cols - 1 - curvatureRegion) * j) / _config.nFeatureRegions;
+      int ep = (curvatureRegion * (_config.nFeatureRegions - 1 - j)
+                + (cols - 1 - curvatureRegion) * (j + 1)) / _config.nFeatureRegions - 1;
+
+      // skip empty regions
+      if (ep <= sp) {
+        continue;
+      }
+
+      // sort the pixels with a complete curvature region by curvature
+      _regionSortIndices.clear();
+      for (int c = sp; c <= ep; c++) {
+        if (_regionCurvature[c] >= 0) {
+          _regionSortIndices.push_back(c);
+        }
+      }
+      std::sort(_regionSortIndices.begin(), _regionSortIndices.end(),
+                [this](const size_t& a, const size_t& b) { return _regionCurvature[a] < _regionCurvature[b]; });
+      size_t regionSize = _regionSortIndices.size();
+
+      // extract corner features
+      int largestPickedNum = 0;
+      for (size_t k = regionSize; k > 0 && largestPickedNum < _config.maxCornerLessSharp;) {
+        size_t col = _regionSortIndices[--k];
+
+        if (_scanNeighborPicked[col] == 0 &&
+            _regionCurvature[col] > _config.surfaceCurvatureThreshold) {
+
+          image.getPoint(row, col, point);
+          point.ring = scanID;
+          point.relTime = image.getRelTime(row, col, _config.scanPeriod);
+
+          largestPickedNum++;
+          if (largestPickedNum <= _config.maxCornerSharp) {
+            _regionLabel[col] = CORNER_SHARP;
+            _cornerPointsSharp.push_back(point);
+          } else {
+            _regionLabel[col] = CORNER_LESS_SHARP;
+          }
+          _cornerPointsLessSharp.push_back(point);
+
+          markAsPicked(image, row, col);
+        }
+      }
+
+      // extract flat surface features
+      int smallestPickedNum = 0;
+      for (size_t k = 0; k < regionSize && smallestPickedNum < _config.maxSurfaceFlat; k++) {
+        size_t col = _regionSortIndices[k];
+
+        if (_scanNeighborPicked[col] == 0 &&
+            _regionCurvature[col] < _config.surfaceCurvatureThreshold) {
+
+          image.getPoint(row, col, point);
+          point.ring = scanID;
+          point.relTime = image.getRelTime(row, col, _config.scanPeriod);
+
+          smallestPickedNum++;
+          _regionLabel[col] = SURFACE_FLAT;
+          _surfacePointsFlat.push_back(point);
+
+          markAsPicked(image, row, col);
+        }
+      }
+
+      // extract less flat surface features
+      for (int c = sp; c <= ep; c++) {
+        if (_regionLabel[c] <= SURFACE_LESS_FLAT && image.isValid(row, c)) {
+          image.getPoint(row, c, point);
+          point.ring = scanID;
+          point.relTime = image.getRelTime(row, c, _config.scanPeriod);
+          _surfPointsLessFlatScan.push_back(point);
         }
       }
     }
 
-    // down size less flat surface point cloud of current scan
-//    pcl::PointCloud<pcl::PointXYZI> surfPointsLessFlatScanDS;
-//    pcl::VoxelGrid<pcl::PointXYZI> downSizeFilter;
-//    downSizeFilter.setInputCloud(_surfacePointsLessFlat.makeShared());
-//    downSizeFilter.setLeafSize(_config.lessFlatFilterSize, _config.lessFlatFilterSize, _config.lessFlatFilterSize);
-//    downSizeFilter.filter(surfPointsLessFlatScanDS);
+    appendLessFlatScan(_config.maxSurfaceLessFlat);
+  }
+}
 
-//    _surfacePointsLessFlat += surfPointsLessFlatScanDS;
+void BasicScanRegistration::appendLessFlatScan(const size_t& maxLessFlatNum)
+{
+  // down size less flat surface point cloud of current scan
+  _lessFlatFilter.filter(_surfPointsLessFlatScan, _surfPointsLessFlatScanDS);
+
+  // limit less flat surface points of current scan by evenly thinning along the scan
+  size_t lessFlatNum = _surfPointsLessFlatScanDS.size();
+  if (maxLessFlatNum > 0 && lessFlatNum > maxLessFlatNum) {
+    for (size_t k = 0; k < maxLessFlatNum; k++) {
+      _surfPointsLessFlatScanDS[k] = _surfPointsLessFlatScanDS[k * lessFlatNum / maxLessFlatNum];
+    }
+    _surfPointsLessFlatScanDS.resize(maxLessFlatNum);
   }
+
+  _surfacePointsLessFlat += _surfPointsLessFlatScanDS;
 }
 
 void BasicScanRegistration::updateIMUTransform()
@@ -254,31 +527,40 @@ void BasicScanRegistration::setRegionBuffersFor(const size_t& startIdx, const si
   _regionLabel.assign(regionSize, SURFACE_LESS_FLAT);
 
   // calculate point curvatures and reset sort indices
+  if (_curvatureKernel) {
+    _curvatureKernel(_laserCloudSoA, startIdx, endIdx, _regionCurvature.data(), _regionSortIndices.data());
+  } else {
+    computeCurvature(startIdx, endIdx);
+  }
+
+  // sort point curvatures (stable, so points of equal curvature keep their order)
+  std::stable_sort(_regionSortIndices.begin(), _regionSortIndices.end(),
+                   [this, &startIdx](const size_t& a, const size_t& b) {
+                     return _regionCurvature[a - startIdx] < _regionCurvature[b - startIdx];
+                   });
+}
+
+void BasicScanRegistration::computeCurvature(const size_t& startIdx, const size_t& endIdx)
+{
   float pointWeight = -2 * _config.curvatureRegion;
+  const float* x = _laserCloudSoA.x();
+  const float* y = _laserCloudSoA.y();
+  const float* z = _laserCloudSoA.z();
 
   for (size_t i = startIdx, regionIdx = 0; i <= endIdx; i++, regionIdx++) {
-    float diffX = pointWeight * _laserCloud[i].x;
-    float diffY = pointWeight * _laserCloud[i].y;
-    float diffZ = pointWeight * _laserCloud[i].z;
+    float diffX = pointWeight * x[i];
+    float diffY = pointWeight * y[i];
+    float diffZ = pointWeight * z[i];
 
     for (int j = 1; j <= _config.curvatureRegion; j++) {
-      diffX += _laserCloud[i + j].x + _laserCloud[i - j].x;
-      diffY += _laserCloud[i + j].y + _laserCloud[i - j].y;
-      diffZ += _laserCloud[i + j].z + _laserCloud[i - j].z;
+      diffX += x[i + j] + x[i - j];
+      diffY += y[i + j] + y[i - j];
+      diffZ += z[i + j] + z[i - j];
     }
 
     _regionCurvature[regionIdx] = diffX * diffX + diffY * diffY + diffZ * diffZ;
     _regionSortIndices[regionIdx] = i;
   }
-
-  // sort point curvatures
-  for (size_t i = 1; i < regionSize; i++) {
-    for (size_t j = i; j >= 1; j--) {
-      if (_regionCurvature[_regionSortIndices[j] - startIdx] < _regionCurvature[_regionSortIndices[j - 1] - startIdx]) {
-        std::swap(_regionSortIndices[j], _regionSortIndices[j - 1]);
-      }
-    }
-  }
 }
 
 void BasicScanRegistration::setScanBuffersFor(const size_t& startIdx, const size_t& endIdx)
@@ -289,9 +571,9 @@ void BasicScanRegistration::setScanBuffersFor(const size_t& startIdx, const size
 
   // mark unreliable points as picked
   for (size_t i = startIdx + _config.curvatureRegion; i < endIdx - _config.curvatureRegion; i++) {
-    const pcl::PointXYZI& previousPoint = (_laserCloud[i - 1]);
-    const pcl::PointXYZI& point = (_laserCloud[i]);
-    const pcl::PointXYZI& nextPoint = (_laserCloud[i + 1]);
+    const PointXYZIRT& previousPoint = (_laserCloud[i - 1]);
+    const PointXYZIRT& point = (_laserCloud[i]);
+    const PointXYZIRT& nextPoint = (_laserCloud[i + 1]);
 
     float diffNext = calcSquaredDiff(nextPoint, point);
 
@@ -325,8 +607,120 @@ void BasicScanRegistration::setScanBuffersFor(const size_t& startIdx, const size
   }
 }
 
+void BasicScanRegistration::setRowBuffersFor(const RangeImage& image, const int& row)
+{
+  // resize buffers
+  const int cols = image.cols;
+  const int curvatureRegion = _config.curvatureRegion;
+  _regionCurvature.assign(cols, -1);
+  _regionLabel.assign(cols, SURFACE_LESS_FLAT);
+  _scanNeighborPicked.assign(cols, 0);
+
+  // calculate point curvatures of all pixels whose curvature region is free of empty pixels
+  const float pointWeight = -2 * curvatureRegion;
+  const size_t stride = image.colStride;
+  const float* rowData = image.pixel(row, 0);
+  int validRun = 0;
+  for (int c = 0; c < cols; c++) {
+    validRun = rowData[c * stride] != 0 ? validRun + 1 : 0;
+    if (validRun <= 2 * curvatureRegion) {
+      continue;
+    }
+
+    const int center = c - curvatureRegion;
+    const float* p = rowData + center * stride;
+    float diffX = pointWeight * p[0];
+    float diffY = pointWeight * p[1];
+    float diffZ = pointWeight * p[2];
+
+    for (int k = 1; k <= curvatureRegion; k++) {
+      diffX += p[k * stride] + p[-k * stride];
+      diffY += p[k * stride + 1] + p[-k * stride + 1];
+      diffZ += p[k * stride + 2] + p[-k * stride + 2];
+    }
+
+    _regionCurvature[center] = diffX * diffX + diffY * diffY + diffZ * diffZ;
+  }
+
+  // mark unreliable points as picked
+  PointXYZIRT previousPoint, point, nextPoint;
+  for (int c = 0; c < cols; c++) {
+    if (_regionCurvature[c] < 0) {
+      _scanNeighborPicked[c] = 1;
+      continue;
+    }
+
+    image.getPoint(row, c - 1, previousPoint);
+    image.getPoint(row, c, point);
+    image.getPoint(row, c + 1, nextPoint);
+
+    float diffNext = calcSquaredDiff(nextPoint, point);
+
+    if (diffNext > 0.1) {
+      float depth1 = calcPointDistance(point);
+      float depth2 = calcPointDistance(nextPoint);
+
+      if (depth1 > depth2) {
+        float weighted_distance = std::sqrt(calcSquaredDiff(nextPoint, point, depth2 / depth1)) / depth2;
+
+        if (weighted_distance < 0.1) {
+          std::fill_n(&_scanNeighborPicked[c - curvatureRegion], curvatureRegion + 1, 1);
+
+          continue;
+        }
+      } else {
+        float weighted_distance = std::sqrt(calcSquaredDiff(point, nextPoint, depth1 / depth2)) / depth1;
+
+        if (weighted_distance < 0.1) {
+          std::fill_n(&_scanNeighborPicked[c + 1], std::min(curvatureRegion + 1, cols - c - 1), 1);
+        }
+      }
+    }
+
+    float diffPrevious = calcSquaredDiff(point, previousPoint);
+    float dis = calcSquaredPointDistance(point);
+
+    if (diffNext > 0.0002 * dis && diffPrevious > 0.0002 * dis) {
+      _scanNeighborPicked[c] = 1;
+    }
+  }
+}
+
+void BasicScanRegistration::markAsPicked(const RangeImage& image, const int& row, const int& col)
+{
+  _scanNeighborPicked[col] = 1;
+
+  PointXYZIRT point, previousPoint;
+  image.getPoint(row, col, previousPoint);
+  for (int i = 1; i <= _config.curvatureRegion && col + i < image.cols && image.isValid(row, col + i); i++) {
+    image.getPoint(row, col + i, point);
+    if (calcSquaredDiff(point, previousPoint) > 0.05) {
+      break;
+    }
+
+    _scanNeighborPicked[col + i] = 1;
+    previousPoint = point;
+  }
+
+  image.getPoint(row, col, previousPoint);
+  for (int i = 1; i <= _config.curvatureRegion && col - i >= 0 && image.isValid(row, col - i); i++) {
+    image.getPoint(row, col - i, point);
+    if (calcSquaredDiff(point, previousPoint) > 0.05) {
+      break;
+    }
+
+    _scanNeighborPicked[col - i] = 1;
+    previousPoint = point;
+  }
+}
+
 void BasicScanRegistration::markAsPicked(const size_t& cloudIdx, const size_t& scanIdx)
 {
+  if (_markAsPickedKernel) {
+    _markAsPickedKernel(_laserCloud.points.data(), cloudIdx, &_scanNeighborPicked[scanIdx]);
+    return;
+  }
+
   _scanNeighborPicked[scanIdx] = 1;
 
   for (int i = 1; i <= _config.curvatureRegion; i++) {
@@ -28,6 +28,10 @@
 #include "Angle.h"
 #include "Vector3.h"
 #include "CircularBuffer.h"
+#include "VoxelHashFilter.h"
+#include "PointTypes.h"
+#include "ScanKernels.h"
+#include "RangeImage.h"
 #include "time_utils.h"
 
 namespace loam
@@ -61,7 +65,8 @@ namespace loam
       const int& maxCornerSharp_ = 2,
       const int& maxSurfaceFlat_ = 4,
       const float& lessFlatFilterSize_ = 0.2,
-      const float& surfaceCurvatureThreshold_ = 0.1);
+      const float& surfaceCurvatureThreshold_ = 0.1,
+      const int& maxSurfaceLessFlat_ = 200);
 
     /** The time per scan. */
     float scanPeriod;
@@ -89,6 +94,9 @@ namespace loam
 
     /** The curvature threshold below / above a point is considered a flat / corner point. */
     float surfaceCurvatureThreshold;
+
+    /** The maximum number of (down sized) less flat surface points per scan ring (0 = unlimited). */
+    int maxSurfaceLessFlat;
   };
 
 
@@ -155,17 +163,81 @@ namespace loam
   class BasicScanRegistration
   {
   public:
+    BasicScanRegistration();
+
     /** \brief Process a new cloud as a set of scanlines.
     *
     * @param relTime the time relative to the scan time
     */
     void processScanlines(const long long& scanTime,
-            std::vector<pcl::PointCloud<pcl::PointXYZI>> const& laserCloudScans,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&,
-            pcl::PointCloud<pcl::PointXYZI>&);
+            std::vector<pcl::PointCloud<PointXYZIRT>> const& laserCloudScans,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&);
 
+    /** \brief Process a new organized range image, extracting features directly on its rows.
+    *
+    * Each used image row is treated as one scan ring. Curvature, occlusion masks and feature labels are
+    * computed in place on the image, empty pixels interrupt the curvature region.
+    *
+    * @param scanTime the scan time
+    * @param image the organized range image
+    */
+    void processRangeImage(const long long& scanTime,
+            const RangeImage& image,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&,
+            pcl::PointCloud<PointXYZIRT>&);
+
+    /** \brief Start a new sweep for sector-wise (streaming) processing.
+    *
+    * @param scanTime the scan time of the sweep
+    * @param nSectors the number of sectors the sweep is delivered in
+    */
+    void beginSweep(const long long& scanTime, const int& nSectors);
+
+    /** \brief Process the next sector of the current sweep.
+    *
+    * The sector points are appended to their scan rings. Features are extracted for all ring points whose
+    * curvature region is complete. The last curvatureRegion points of every ring are held back until the next
+    * sector arrives (or endSweep() is called), and the chunks overlap by curvatureRegion points of context at the seams. Each ring chunk
+    * gets its share of the nFeatureRegions regions of a full ring.
+    *
+    * @param sectorScans the new points of the sector per scan ring
+    * @param cornerPointsSharp the output sharp corner points of this sector
+    * @param cornerPointsLessSharp the output less sharp corner points of this sector
+    * @param surfPointsLessFlat the output less flat surface points of this sector
+    * @param surfPointsFlat the output flat surface points of this sector
+    */
+    void processSectorScanlines(std::vector<pcl::PointCloud<PointXYZIRT>> const& sectorScans,
+            pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+            pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+            pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+            pcl::PointCloud<PointXYZIRT>& surfPointsFlat);
+
+    /** \brief Finish the current sweep after its last sector.
+    *
+    * Extracts the features of the ring points held back by processSectorScanlines(). A sweep covers a full turn,
+    * so the start of every ring provides the missing curvature context of its end, and the first curvatureRegion
+    * points of every ring are extracted as well.
+    *
+    * @param cornerPointsSharp the output sharp corner points of the ring ends
+    * @param cornerPointsLessSharp the output less sharp corner points of the ring ends
+    * @param surfPointsLessFlat the output less flat surface points of the ring ends
+    * @param surfPointsFlat the output flat surface points of the ring ends
+    */
+    void endSweep(pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+            pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+            pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+            pcl::PointCloud<PointXYZIRT>& surfPointsFlat);
+
+    /** \brief Set the registration parameters and select the feature kernels specialized for them.
+     *
+     * @param config the registration parameters
+     * @return true if specialized kernels exist for the configured curvature region, false if the generic ones are used
+     */
     bool configure(const RegistrationParams& config = RegistrationParams());
 
     /** \brief Update new IMU state. NOTE: MUTATES ARGS! */
@@ -177,7 +249,7 @@ namespace loam
     * @param point The point to modify
     * @param relTime The time to project by
     */
-    void projectPointToStartOfSweep(pcl::PointXYZI& point, float relTime);
+    void projectPointToStartOfSweep(PointXYZIRT& point, float relTime);
 
     auto const& imuTransform          () { return _imuTrans             ; }
     auto const& sweepStart            () { return _sweepStart           ; }
@@ -205,9 +277,12 @@ namespace loam
      *
      * @param point the point to project
      */
-    void transformToStartIMU(pcl::PointXYZI& point);
+    void transformToStartIMU(PointXYZIRT& point);
 
     /** \brief Prepare for next scan / sweep.
+     *
+     * Internal clouds and buffers are cleared but keep their capacity, so a long-lived
+     * registration instance does not reallocate them on every frame.
      *
      * @param scanTime the current scan time
      * @param newSweep indicator if a new sweep has started
@@ -217,8 +292,21 @@ namespace loam
     /** \brief Extract features from current laser cloud.
      *
      * @param beginIdx the index of the first scan to extract features from
+     * @param nRegions the number of feature regions per scan (0 = nFeatureRegions)
      */
-    void extractFeatures(const uint16_t& beginIdx = 0);
+    void extractFeatures(const uint16_t& beginIdx = 0, const int& nRegions = 0);
+
+    /** \brief Extract features from the rows of an organized range image.
+     *
+     * @param image the organized range image
+     */
+    void extractFeatures(const RangeImage& image);
+
+    /** \brief Down size and thin the less flat surface points of the current scan and append them to the result.
+     *
+     * @param maxLessFlatNum the maximum number of less flat surface points of the scan (0 = unlimited)
+     */
+    void appendLessFlatScan(const size_t& maxLessFlatNum);
 
     /** \brief Set up region buffers for the specified point range.
      *
@@ -228,6 +316,14 @@ namespace loam
     void setRegionBuffersFor(const size_t& startIdx,
       const size_t& endIdx);
 
+    /** \brief Calculate point curvatures and reset sort indices with the generic (runtime curvature region) kernel.
+     *
+     * @param startIdx the region start index
+     * @param endIdx the region end index
+     */
+    void computeCurvature(const size_t& startIdx,
+      const size_t& endIdx);
+
     /** \brief Set up scan buffers for the specified point range.
      *
      * @param startIdx the scan start index
@@ -236,6 +332,26 @@ namespace loam
     void setScanBuffersFor(const size_t& startIdx,
       const size_t& endIdx);
 
+    /** \brief Calculate point curvatures and mark unreliable pixels as picked for the specified image row.
+     *
+     * Pixels without a complete curvature region get a negative curvature.
+     *
+     * @param image the organized range image
+     * @param row the image row
+     */
+    void setRowBuffersFor(const RangeImage& image,
+      const int& row);
+
+    /** \brief Mark a pixel and its neighbors within the same image row as picked.
+     *
+     * @param image the organized range image
+     * @param row the image row
+     * @param col the image column of the picked pixel
+     */
+    void markAsPicked(const RangeImage& image,
+      const int& row,
+      const int& col);
+
     /** \brief Mark a point and its neighbors as picked.
      *
      * This method will mark neighboring points within the curvature region as picked,
@@ -259,13 +375,14 @@ namespace loam
   private:
     RegistrationParams _config;  ///< registration parameter
 
-    pcl::PointCloud<pcl::PointXYZI> _laserCloud;   ///< full resolution input cloud
+    pcl::PointCloud<PointXYZIRT> _laserCloud;   ///< full resolution input cloud
+    CloudSoA _laserCloudSoA;                    ///< coordinates of the full resolution input cloud
     std::vector<IndexRange> _scanIndices;          ///< start and end indices of the individual scans withing the full resolution cloud
 
-    pcl::PointCloud<pcl::PointXYZI> _cornerPointsSharp;      ///< sharp corner points cloud
-    pcl::PointCloud<pcl::PointXYZI> _cornerPointsLessSharp;  ///< less sharp corner points cloud
-    pcl::PointCloud<pcl::PointXYZI> _surfacePointsFlat;      ///< flat surface points cloud
-    pcl::PointCloud<pcl::PointXYZI> _surfacePointsLessFlat;  ///< less flat surface points cloud
+    pcl::PointCloud<PointXYZIRT> _cornerPointsSharp;      ///< sharp corner points cloud
+    pcl::PointCloud<PointXYZIRT> _cornerPointsLessSharp;  ///< less sharp corner points cloud
+    pcl::PointCloud<PointXYZIRT> _surfacePointsFlat;      ///< flat surface points cloud
+    pcl::PointCloud<PointXYZIRT> _surfacePointsLessFlat;  ///< less flat surface points cloud
 
     Time _sweepStart;            ///< time stamp of beginning of current sweep
     Time _scanTime;              ///< time stamp of most recent scan
@@ -281,6 +398,17 @@ namespace loam
     std::vector<PointLabel> _regionLabel;     ///< point label buffer
     std::vector<size_t> _regionSortIndices;   ///< sorted region indices based on point curvature
     std::vector<int> _scanNeighborPicked;     ///< flag if neighboring point was already picked
+
+    CurvatureFunction _curvatureKernel = NULL;          ///< specialized curvature kernel (NULL = generic)
+    MarkAsPickedFunction _markAsPickedKernel = NULL;    ///< specialized neighbor marking kernel (NULL = generic)
+
+    pcl::PointCloud<PointXYZIRT> _surfPointsLessFlatScan;     ///< less flat surface points of the current scan
+    pcl::PointCloud<PointXYZIRT> _surfPointsLessFlatScanDS;   ///< down sampled less flat surface points of the current scan
+    VoxelHashFilter<PointXYZIRT> _lessFlatFilter;             ///< down size filter for less flat surface points
+
+    std::vector<pcl::PointCloud<PointXYZIRT>> _sweepScans;   ///< scan rings of the current sweep (sector-wise processing)
+    std::vector<size_t> _sweepScanDone;                      ///< index of the first ring point without extracted features
+    int _sweepSectors = 1;                                   ///< number of sectors per sweep
   };
 
 }
@@ -0,0 +1,126 @@
+#ifndef LOAM_FEATUREBUDGETCONTROLLER_H
+#define LOAM_FEATUREBUDGETCONTROLLER_H
+
+#include <algorithm>
+#include <cmath>
+
+#include "BasicScanRegistration.h"
+
+
+namespace loam {
+
+
+
+/** \brief Closed-loop controller of the feature budget per frame.
+ *
+ * The cost of odometry and mapping grows with the number of extracted features. The controller is fed the
+ * measured latency of every frame and scales the per region feature limits of the registration parameters
+ * (maxCornerSharp, maxCornerLessSharp, maxSurfaceFlat and maxSurfaceLessFlat) so that a target frame time is
+ * held. The scale is bounded, so the feature density never drops below or rises above the configured range.
+ *
+ * The latency is smoothed exponentially. The budget shrinks in proportion to an overrun (at most 30% per frame)
+ * and grows slowly (at most 10% per frame) once the frame time is well below the target. Within a dead band
+ * around the target the budget is kept, so the parameters do not oscillate.
+ *
+ * nFeatureRegions and curvatureRegion are kept: they define where features are picked, not how many.
+ */
+class FeatureBudgetController {
+public:
+  /** \brief Construct a new controller.
+   *
+   * @param baseParams the registration parameters at scale 1
+   * @param targetTime the target frame time (in ms)
+   * @param minScale the smallest feature budget scale
+   * @param maxScale the largest feature budget scale
+   */
+  FeatureBudgetController(const RegistrationParams& baseParams,
+                          const double& targetTime,
+                          const float& minScale = 0.25,
+                          const float& maxScale = 2)
+        : _baseParams(baseParams),
+          _params(baseParams),
+          _targetTime(targetTime),
+          _minScale(minScale),
+          _maxScale(std::max(minScale, maxScale)),
+          _scale(std::min(std::max(1.0f, minScale), _maxScale)),
+          _meanTime(0)
+  {
+    apply();
+  }
+
+  void setTargetTime(const double& targetTime) { _targetTime = targetTime; }
+  const double& getTargetTime() const { return _targetTime; }
+
+  /** \brief The current feature budget scale. */
+  const float& scale() const { return _scale; }
+
+  /** \brief The smoothed frame time (in ms). */
+  const double& meanTime() const { return _meanTime; }
+
+  /** \brief The registration parameters for the current budget. */
+  const RegistrationParams& params() const { return _params; }
+
+  /** \brief Feed the latency of a frame and update the feature budget.
+   *
+   * @param frameTime the measured frame time (in ms)
+   * @return true if the registration parameters changed, false otherwise
+   */
+  bool update(const double& frameTime)
+  {
+    _meanTime = _meanTime > 0 ? (1 - SMOOTHING) * _meanTime + SMOOTHING * frameTime : frameTime;
+    if (_meanTime <= 0 || _targetTime <= 0)
+      return false;
+
+    const double ratio = _targetTime / _meanTime;
+    if (ratio > 1 - DEAD_BAND && ratio < 1 + 2 * DEAD_BAND)
+      return false;
+
+    const float step = float(std::min(std::max(ratio, 0.7), 1.1));
+    const float scale = std::min(std::max(_scale * step, _minScale), _maxScale);
+    if (scale == _scale)
+      return false;
+    _scale = scale;
+    return apply();
+  }
+
+private:
+  /** Weight of the latest frame in the smoothed frame time. */
+  static constexpr double SMOOTHING = 0.3;
+
+  /** Relative deviation from the target frame time that is tolerated. */
+  static constexpr double DEAD_BAND = 0.1;
+
+  static int scaled(const int& value, const float& scale)
+  {
+    return value > 0 ? std::max(1, int(std::lround(value * scale))) : value;
+  }
+
+  /** Derive the parameters for the current scale, returns true if they changed. */
+  bool apply()
+  {
+    RegistrationParams params = _baseParams;
+    params.maxCornerSharp = scaled(_baseParams.maxCornerSharp, _scale);
+    params.maxCornerLessSharp = scaled(_baseParams.maxCornerLessSharp, _scale);
+    params.maxSurfaceFlat = scaled(_baseParams.maxSurfaceFlat, _scale);
+    params.maxSurfaceLessFlat = scaled(_baseParams.maxSurfaceLessFlat, _scale);   // 0 = unlimited stays unlimited
+
+    const bool changed = params.maxCornerSharp != _params.maxCornerSharp
+                         || params.maxCornerLessSharp != _params.maxCornerLessSharp
+                         || params.maxSurfaceFlat != _params.maxSurfaceFlat
+                         || params.maxSurfaceLessFlat != _params.maxSurfaceLessFlat;
+    _params = params;
+    return changed;
+  }
+
+  RegistrationParams _baseParams;   ///< registration parameters at scale 1
+  RegistrationParams _params;       ///< registration parameters for the current scale
+  double _targetTime;               ///< target frame time (in ms)
+  float _minScale;                  ///< smallest feature budget scale
+  float _maxScale;                  ///< largest feature budget scale
+  float _scale;                     ///< current feature budget scale
+  double _meanTime;                 ///< smoothed frame time (in ms)
+};
+
+} // end namespace loam
+
+#endif //LOAM_FEATUREBUDGETCONTROLLER_H
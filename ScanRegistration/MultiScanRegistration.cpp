@@ -39,37 +39,30 @@ MultiScanRegistration::MultiScanRegistration(const MultiScanMapper& scanMapper)
 {};
 
 
-void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZI>::Ptr laserCloudIn,
-        const long long& scanTime,
-        pcl::PointCloud<pcl::PointXYZI>& _cornerPointsSharp,
-        pcl::PointCloud<pcl::PointXYZI>& _cornerPointsLessSharp,
-        pcl::PointCloud<pcl::PointXYZI>& _surfPointsLessFlat,
-        pcl::PointCloud<pcl::PointXYZI>& _surfPointsFlat)
+template <uint16_t NRings>
+void MultiScanRegistration::binScanRings(const pcl::PointCloud<pcl::PointXYZI>& laserCloudIn,
+                                         const float& startOri,
+                                         const float& endOri)
 {
-  // determine size of current pointcloud frame
-  size_t cloudSize = laserCloudIn->width * laserCloudIn->height;
-
-  // determine scan start and end orientations
-  float startOri = -std::atan2(laserCloudIn->points[0].y, laserCloudIn->points[0].x);
-  float endOri = -std::atan2(laserCloudIn->points[cloudSize - 1].y, laserCloudIn->points[cloudSize - 1].x) + 2 * float(M_PI);
-  if (endOri - startOri > 3 * M_PI) endOri -= 2 * M_PI;
-  else if (endOri - startOri < M_PI) endOri += 2 * M_PI;
+  size_t cloudSize = laserCloudIn.points.size();
+  RingCounts<NRings> ringCounts(_scanMapper.getNumberOfScanRings());
+  const int nRings = ringCounts.size();
 
-  // clear all scanline points
-  std::for_each(_laserCloudScans.begin(), _laserCloudScans.end(), [](auto&&v) {v.clear(); }); 
+  _scanPoints.resize(cloudSize);
+  _scanPointRings.resize(cloudSize);
 
- 
   // extract valid points from input cloud
   bool halfPassed = false;
-  pcl::PointXYZI point;
-  _laserCloudScans.resize(_scanMapper.getNumberOfScanRings());
+  PointXYZIRT point;
 
-  for (int i = 0; i < cloudSize; i++) {
+  for (size_t i = 0; i < cloudSize; i++) {
+      _scanPointRings[i] = -1;
 
       /* 对点云进行坐标变换 */
-      point.x = laserCloudIn->points[i].x;
-      point.y = laserCloudIn->points[i].y;
-      point.z = laserCloudIn->points[i].z - 2.6;
+      point.x = laserCloudIn.points[i].x;
+      point.y = laserCloudIn.points[i].y;
+      point.z = laserCloudIn.points[i].z - 2.6;
+      point.intensity = laserCloudIn.points[i].intensity;
 //      point.x = laserCloudIn[i].z;
 //      point.y = laserCloudIn[i].y;
 //      point.z = -1.0 * laserCloudIn[i].x;
@@ -91,7 +84,7 @@ void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZI>::Ptr l
 
     int scanID = _scanMapper.getRingForAngle(angle);
 
-    if (scanID >= _scanMapper.getNumberOfScanRings() || scanID < 0 ){
+    if (scanID >= nRings || scanID < 0 ){
       continue;
     }
 
@@ -120,16 +113,100 @@ void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZI>::Ptr l
     // calculate relative scan time based on point orientation
     float relTime = 0.1 * (ori - startOri) / (endOri - startOri); /* 激光传感器频率为10Hz */
 //    point.intensity = (ori - startOri) / (endOri - startOri) * 256 - 1; /* 检测oritation计算是否正确 */
-    point.intensity = scanID + relTime;
+    point.ring = scanID;
+    point.relTime = relTime;
 
 
 //    projectPointToStartOfSweep(point, relTime);
 
+    _scanPoints[i] = point;
+    _scanPointRings[i] = scanID;
+    ringCounts.n[scanID]++;
+  }
+
+  // clear all scanline points, reserving the exact ring sizes
+  _laserCloudScans.resize(nRings);
+  for (int r = 0; r < nRings; r++) {
+    _laserCloudScans[r].clear();
+    _laserCloudScans[r].reserve(ringCounts.n[r]);
+  }
+
+  for (size_t i = 0; i < cloudSize; i++) {
+    if (_scanPointRings[i] >= 0) {
+      _laserCloudScans[_scanPointRings[i]].push_back(_scanPoints[i]);
+    }
+  }
+}
+
+
+void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZI>::Ptr laserCloudIn,
+        const long long& scanTime,
+        pcl::PointCloud<PointXYZIRT>& _cornerPointsSharp,
+        pcl::PointCloud<PointXYZIRT>& _cornerPointsLessSharp,
+        pcl::PointCloud<PointXYZIRT>& _surfPointsLessFlat,
+        pcl::PointCloud<PointXYZIRT>& _surfPointsFlat)
+{
+  // determine size of current pointcloud frame
+  size_t cloudSize = laserCloudIn->width * laserCloudIn->height;
+
+  // determine scan start and end orientations
+  float startOri = -std::atan2(laserCloudIn->points[0].y, laserCloudIn->points[0].x);
+  float endOri = -std::atan2(laserCloudIn->points[cloudSize - 1].y, laserCloudIn->points[cloudSize - 1].x) + 2 * float(M_PI);
+  if (endOri - startOri > 3 * M_PI) endOri -= 2 * M_PI;
+  else if (endOri - startOri < M_PI) endOri += 2 * M_PI;
+
+  // sort points into scan rings, using the ring count specialized path for the known sensors
+  switch (_scanMapper.getNumberOfScanRings()) {
+    case 16: binScanRings<16>(*laserCloudIn, startOri, endOri); break;
+    case 32: binScanRings<32>(*laserCloudIn, startOri, endOri); break;
+    case 64: binScanRings<64>(*laserCloudIn, startOri, endOri); break;
+    default: binScanRings<0>(*laserCloudIn, startOri, endOri); break;
+  }
+
+  processScanlines(scanTime, _laserCloudScans, _cornerPointsSharp, _cornerPointsLessSharp, _surfPointsLessFlat, _surfPointsFlat);
+}
+
+void MultiScanRegistration::processSector(const pcl::PointCloud<PointXYZIRT>& sectorCloud,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+        pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+        pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+        pcl::PointCloud<PointXYZIRT>& surfPointsFlat)
+{
+  const int nRings = _scanMapper.getNumberOfScanRings();
+  _laserCloudScans.resize(nRings);
+  for (int r = 0; r < nRings; r++) {
+    _laserCloudScans[r].clear();
+  }
+
+  // sort the sector points into scan rings, the relative time is provided by the caller
+  PointXYZIRT point;
+  for (size_t i = 0; i < sectorCloud.points.size(); i++) {
+    point = sectorCloud.points[i];
+    point.z -= 2.6;
+
+    // skip NaN and INF valued points
+    if (!pcl_isfinite(point.x) ||
+        !pcl_isfinite(point.y) ||
+        !pcl_isfinite(point.z)) {
+      continue;
+    }
+
+    // skip zero valued points
+    if (point.x * point.x + point.y * point.y + point.z * point.z < 0.0001) {
+      continue;
+    }
+
+    float angle = std::atan(point.z / std::sqrt(point.x * point.x + point.y * point.y));
+    int scanID = _scanMapper.getRingForAngle(angle);
+    if (scanID >= nRings || scanID < 0) {
+      continue;
+    }
+
+    point.ring = scanID;
     _laserCloudScans[scanID].push_back(point);
   }
 
-    processScanlines(scanTime, _laserCloudScans, _cornerPointsSharp, _cornerPointsLessSharp, _surfPointsLessFlat, _surfPointsFlat);
-  
+  processSectorScanlines(_laserCloudScans, cornerPointsSharp, cornerPointsLessSharp, surfPointsLessFlat, surfPointsFlat);
 }
 
 } // end namespace loam
@@ -67,14 +67,42 @@ public:
   MultiScanRegistration(const MultiScanMapper& scanMapper = MultiScanMapper());
   void process(const pcl::PointCloud<pcl::PointXYZI>::Ptr,
           const long long& scanTime,
-          pcl::PointCloud<pcl::PointXYZI> &,
-          pcl::PointCloud<pcl::PointXYZI> &,
-          pcl::PointCloud<pcl::PointXYZI> &,
-          pcl::PointCloud<pcl::PointXYZI> &);
+          pcl::PointCloud<PointXYZIRT> &,
+          pcl::PointCloud<PointXYZIRT> &,
+          pcl::PointCloud<PointXYZIRT> &,
+          pcl::PointCloud<PointXYZIRT> &);
+
+  /** \brief Process the next azimuth sector of the current sweep (see beginSweep()).
+   *
+   * @param sectorCloud the sector points, with their relative time already set
+   * @param cornerPointsSharp the output sharp corner points of this sector
+   * @param cornerPointsLessSharp the output less sharp corner points of this sector
+   * @param surfPointsLessFlat the output less flat surface points of this sector
+   * @param surfPointsFlat the output flat surface points of this sector
+   */
+  void processSector(const pcl::PointCloud<PointXYZIRT>& sectorCloud,
+          pcl::PointCloud<PointXYZIRT>& cornerPointsSharp,
+          pcl::PointCloud<PointXYZIRT>& cornerPointsLessSharp,
+          pcl::PointCloud<PointXYZIRT>& surfPointsLessFlat,
+          pcl::PointCloud<PointXYZIRT>& surfPointsFlat);
 
 private:
+  /** \brief Sort the valid points of the input cloud into their scan rings.
+   *
+   * @tparam NRings the number of scan rings (0 = taken from the scan mapper at runtime)
+   * @param laserCloudIn the input cloud
+   * @param startOri the scan start orientation
+   * @param endOri the scan end orientation
+   */
+  template <uint16_t NRings>
+  void binScanRings(const pcl::PointCloud<pcl::PointXYZI>& laserCloudIn,
+                    const float& startOri,
+                    const float& endOri);
+
   MultiScanMapper _scanMapper;  ///< mapper for mapping vertical point angles to scan ring IDs
-  std::vector<pcl::PointCloud<pcl::PointXYZI>> _laserCloudScans;
+  std::vector<pcl::PointCloud<PointXYZIRT>> _laserCloudScans;
+  std::vector<PointXYZIRT, Eigen::aligned_allocator<PointXYZIRT>> _scanPoints;  ///< transformed input points
+  std::vector<int> _scanPointRings;   ///< scan ring ID per input point (-1 = invalid)
 };
 
 } // end namespace loam
@@ -0,0 +1,95 @@
+#ifndef LOAM_NORMALEQUATIONS_H
+#define LOAM_NORMALEQUATIONS_H
+
+#include <Eigen/Core>
+
+
+namespace loam {
+
+
+
+/** \brief Jacobian of point residuals with respect to a 6-DOF pose (roll, pitch, yaw, x, y, z).
+ *
+ * All trigonometric terms of the pose are folded into fixed-size matrices once per iteration. The Jacobian row
+ * of a residual with direction c at point p is then
+ *   (c^T * dR[k] * (p - origin))  for the rotation parameters k = 0, 1, 2 and
+ *   (dT * c)                      for the translation parameters.
+ */
+struct PoseJacobian {
+  Eigen::Matrix3f dR[3];    ///< derivative of the point transform with respect to roll, pitch and yaw
+  Eigen::Vector3f origin;   ///< point offset applied before the rotation derivatives
+  Eigen::Matrix3f dT;       ///< derivative of the residual with respect to the translation
+
+  /** \brief Calculate the Jacobian row of a single residual.
+   *
+   * @param p the point (before transformation)
+   * @param c the residual direction
+   * @param a the output Jacobian row
+   */
+  void row(const Eigen::Vector3f& p, const Eigen::Vector3f& c, Eigen::Matrix<float, 6, 1>& a) const
+  {
+    const Eigen::Vector3f q = p - origin;
+    a(0) = c.dot(dR[0] * q);
+    a(1) = c.dot(dR[1] * q);
+    a(2) = c.dot(dR[2] * q);
+    a.tail<3>() = dT * c;
+  }
+};
+
+
+
+/** \brief Streaming accumulator of the 6x6 normal equations A^T*A * x = A^T*b.
+ *
+ * Residuals are added one row at a time, so no per-residual matrix is allocated and only the upper triangle of
+ * A^T*A is updated. Accumulators of disjoint residual sets can be summed.
+ */
+class NormalEquations {
+public:
+  NormalEquations() { setZero(); }
+
+  void setZero()
+  {
+    _AtA.setZero();
+    _AtB.setZero();
+    _n = 0;
+  }
+
+  /** \brief Add a residual row.
+   *
+   * @param a the Jacobian row
+   * @param b the right hand side of the row
+   */
+  void add(const Eigen::Matrix<float, 6, 1>& a, const float& b)
+  {
+    _AtA.selfadjointView<Eigen::Upper>().rankUpdate(a);
+    _AtB += a * b;
+    _n++;
+  }
+
+  NormalEquations& operator+=(const NormalEquations& other)
+  {
+    _AtA.triangularView<Eigen::Upper>() += other._AtA;
+    _AtB += other._AtB;
+    _n += other._n;
+    return *this;
+  }
+
+  /** \brief The full symmetric A^T*A matrix. */
+  Eigen::Matrix<float, 6, 6> AtA() const { return _AtA.selfadjointView<Eigen::Upper>(); }
+
+  const Eigen::Matrix<float, 6, 1>& AtB() const { return _AtB; }
+
+  /** \brief The number of added residuals. */
+  int size() const { return _n; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  Eigen::Matrix<float, 6, 6> _AtA;   ///< A^T*A (upper triangle only)
+  Eigen::Matrix<float, 6, 1> _AtB;   ///< A^T*b
+  int _n;                            ///< number of residuals
+};
+
+} // end namespace loam
+
+#endif //LOAM_NORMALEQUATIONS_H
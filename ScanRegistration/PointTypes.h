@@ -0,0 +1,82 @@
+#ifndef LOAM_POINTTYPES_H
+#define LOAM_POINTTYPES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/register_point_struct.h>
+
+
+namespace loam {
+
+
+
+/** \brief Lidar point carrying its scan ring and time stamp next to the measured intensity.
+ *
+ * The coordinates occupy the first 16 byte aligned block (x, y, z and padding), so the point can be loaded with a
+ * single aligned vector load. Ring and relative time are kept in dedicated fields instead of being packed into
+ * the intensity.
+ */
+struct EIGEN_ALIGN16 PointXYZIRT
+{
+  PCL_ADD_POINT4D;     ///< x, y, z (and padding)
+  float intensity;     ///< measured intensity
+  float relTime;       ///< time relative to the scan start (in seconds)
+  uint16_t ring;       ///< scan ring ID
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+
+
+/** \brief Structure-of-arrays copy of the coordinates of a point cloud.
+ *
+ * Kernels that process many consecutive points (e.g. curvature computation) vectorize much better on separate,
+ * aligned coordinate arrays than on interleaved points. The buffers keep their capacity between assignments.
+ */
+class CloudSoA {
+public:
+  /** \brief Copy the coordinates of the given cloud.
+   *
+   * @param cloud the source cloud
+   */
+  template <class PointT>
+  void assign(const pcl::PointCloud<PointT>& cloud)
+  {
+    const size_t n = cloud.points.size();
+    _x.resize(n);
+    _y.resize(n);
+    _z.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      _x[i] = cloud.points[i].x;
+      _y[i] = cloud.points[i].y;
+      _z[i] = cloud.points[i].z;
+    }
+  }
+
+  size_t size() const { return _x.size(); }
+  const float* x() const { return _x.data(); }
+  const float* y() const { return _y.data(); }
+  const float* z() const { return _z.data(); }
+
+private:
+  std::vector<float, Eigen::aligned_allocator<float>> _x;   ///< x coordinates
+  std::vector<float, Eigen::aligned_allocator<float>> _y;   ///< y coordinates
+  std::vector<float, Eigen::aligned_allocator<float>> _z;   ///< z coordinates
+};
+
+} // end namespace loam
+
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(loam::PointXYZIRT,
+                                  (float, x, x)
+                                  (float, y, y)
+                                  (float, z, z)
+                                  (float, intensity, intensity)
+                                  (float, relTime, relTime)
+                                  (uint16_t, ring, ring))
+
+#endif //LOAM_POINTTYPES_H
@@ -0,0 +1,193 @@
+#ifndef LOAM_POSE_H
+#define LOAM_POSE_H
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <pcl/point_cloud.h>
+
+
+namespace loam {
+
+
+
+/** \brief 6-DOF pose with a cached rotation.
+ *
+ * The pose is given by a translation and the Euler angles roll, pitch and yaw. A point is transformed by
+ * p' = Rx(roll) * Ry(pitch) * Rz(yaw) * p + t. The rotation is evaluated once on construction (one sin / cos per
+ * angle) and kept as a quaternion and a 3x4 matrix, so transforming points never touches trigonometric
+ * functions again.
+ */
+class Pose {
+public:
+  /** \brief Construct the identity pose. */
+  Pose() { set(0, 0, 0, 0, 0, 0); }
+
+  Pose(const float& x, const float& y, const float& z,
+       const float& roll, const float& pitch, const float& yaw)
+  {
+    set(x, y, z, roll, pitch, yaw);
+  }
+
+  /** \brief Construct a pose from a navigation record with x, y, z, roll, pitch and yaw members (e.g. NAVDATA). */
+  template <class NavT>
+  static Pose fromNav(const NavT& nav)
+  {
+    return Pose(float(nav.x), float(nav.y), float(nav.z), float(nav.roll), float(nav.pitch), float(nav.yaw));
+  }
+
+  /** \brief Construct a pose from a rigid transformation matrix.
+   *
+   * @param m the 3x4 matrix [R | t]
+   */
+  static Pose fromMatrix(const Eigen::Matrix<float, 3, 4>& m)
+  {
+    Pose pose(NoInit{});
+    pose._x = m(0, 3);
+    pose._y = m(1, 3);
+    pose._z = m(2, 3);
+
+    // inverse of R = Rx * Ry * Rz
+    pose._roll = std::atan2(-m(1, 2), m(2, 2));
+    pose._pitch = std::asin(std::max(-1.0f, std::min(1.0f, m(0, 2))));
+    pose._yaw = std::atan2(-m(0, 1), m(0, 0));
+    pose._matrix = m;
+    pose._rotation = Eigen::Quaternionf(m.leftCols<3>());
+    return pose;
+  }
+
+  /** \brief Write the pose to the x, y, z, roll, pitch and yaw members of a navigation record. */
+  template <class NavT>
+  void toNav(NavT& nav) const
+  {
+    nav.x = _x;
+    nav.y = _y;
+    nav.z = _z;
+    nav.roll = _roll;
+    nav.pitch = _pitch;
+    nav.yaw = _yaw;
+  }
+
+  float x() const { return _x; }
+  float y() const { return _y; }
+  float z() const { return _z; }
+  float roll() const { return _roll; }
+  float pitch() const { return _pitch; }
+  float yaw() const { return _yaw; }
+
+  const Eigen::Quaternionf& rotation() const { return _rotation; }
+  Eigen::Vector3f translation() const { return _matrix.col(3); }
+
+  /** \brief The cached 3x4 matrix [R | t]. */
+  const Eigen::Matrix<float, 3, 4>& matrix() const { return _matrix; }
+
+  Eigen::Affine3f affine() const
+  {
+    Eigen::Affine3f t = Eigen::Affine3f::Identity();
+    t.matrix().topRows<3>() = _matrix;
+    return t;
+  }
+
+  /** \brief The inverse pose. */
+  Pose inverse() const
+  {
+    Eigen::Matrix<float, 3, 4> m;
+    m.leftCols<3>() = _matrix.leftCols<3>().transpose();
+    m.col(3) = -(m.leftCols<3>() * _matrix.col(3));
+    return fromMatrix(m);
+  }
+
+  /** \brief The composed pose, which first applies other and then this pose. */
+  Pose operator*(const Pose& other) const
+  {
+    Eigen::Matrix<float, 3, 4> m;
+    m.leftCols<3>() = _matrix.leftCols<3>() * other._matrix.leftCols<3>();
+    m.col(3) = _matrix.leftCols<3>() * other._matrix.col(3) + _matrix.col(3);
+    return fromMatrix(m);
+  }
+
+  /** \brief Transform a point. Fields other than x, y and z are copied. */
+  template <class PointT>
+  PointT transformPoint(const PointT& pi) const
+  {
+    PointT po = pi;
+    po.x = _matrix(0, 0) * pi.x + _matrix(0, 1) * pi.y + _matrix(0, 2) * pi.z + _matrix(0, 3);
+    po.y = _matrix(1, 0) * pi.x + _matrix(1, 1) * pi.y + _matrix(1, 2) * pi.z + _matrix(1, 3);
+    po.z = _matrix(2, 0) * pi.x + _matrix(2, 1) * pi.y + _matrix(2, 2) * pi.z + _matrix(2, 3);
+    return po;
+  }
+
+  /** \brief Transform all points of a cloud.
+   *
+   * @param cloudIn the input cloud
+   * @param cloudOut the output cloud (may be the input cloud)
+   */
+  template <class PointT>
+  void transformCloud(const pcl::PointCloud<PointT>& cloudIn, pcl::PointCloud<PointT>& cloudOut) const
+  {
+    if (&cloudIn != &cloudOut) {
+      cloudOut.header = cloudIn.header;
+      cloudOut.width = cloudIn.width;
+      cloudOut.height = cloudIn.height;
+      cloudOut.is_dense = cloudIn.is_dense;
+      cloudOut.points.resize(cloudIn.points.size());
+    }
+    for (size_t i = 0; i < cloudIn.points.size(); i++) {
+      cloudOut.points[i] = transformPoint(cloudIn.points[i]);
+    }
+  }
+
+  /** \brief Transform all points of a cloud and append them to another cloud.
+   *
+   * @param cloudIn the input cloud
+   * @param cloudOut the cloud to append to (must not be the input cloud)
+   */
+  template <class PointT>
+  void appendTransformed(const pcl::PointCloud<PointT>& cloudIn, pcl::PointCloud<PointT>& cloudOut) const
+  {
+    const size_t offset = cloudOut.points.size();
+    cloudOut.points.resize(offset + cloudIn.points.size());
+    for (size_t i = 0; i < cloudIn.points.size(); i++) {
+      cloudOut.points[offset + i] = transformPoint(cloudIn.points[i]);
+    }
+    cloudOut.width = uint32_t(cloudOut.points.size());
+    cloudOut.height = 1;
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  struct NoInit {};
+  explicit Pose(NoInit) {}
+
+  void set(const float& x, const float& y, const float& z,
+           const float& roll, const float& pitch, const float& yaw)
+  {
+    _x = x;
+    _y = y;
+    _z = z;
+    _roll = roll;
+    _pitch = pitch;
+    _yaw = yaw;
+
+    const float sr = std::sin(roll), cr = std::cos(roll);
+    const float sp = std::sin(pitch), cp = std::cos(pitch);
+    const float sy = std::sin(yaw), cy = std::cos(yaw);
+
+    _matrix << cp * cy,                -cp * sy,                sp,       x,
+               sr * sp * cy + cr * sy, -sr * sp * sy + cr * cy, -sr * cp, y,
+               -cr * sp * cy + sr * sy, cr * sp * sy + sr * cy, cr * cp,  z;
+    _rotation = Eigen::Quaternionf(_matrix.leftCols<3>());
+  }
+
+  float _x, _y, _z;                    ///< translation
+  float _roll, _pitch, _yaw;           ///< Euler angles (in radian)
+  Eigen::Quaternionf _rotation;        ///< cached rotation
+  Eigen::Matrix<float, 3, 4> _matrix;  ///< cached matrix [R | t]
+};
+
+} // end namespace loam
+
+#endif //LOAM_POSE_H
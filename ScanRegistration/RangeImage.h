@@ -0,0 +1,63 @@
+#ifndef LOAM_RANGEIMAGE_H
+#define LOAM_RANGEIMAGE_H
+
+#include <cstddef>
+
+#include "PointTypes.h"
+
+
+namespace loam {
+
+
+
+/** \brief Non-owning view of an organized range image.
+ *
+ * Rows are vertical angle bins (in order of increasing elevation), columns are azimuth bins. A pixel is addressed
+ * by stride arithmetic on its x, y, z floats, so the view can wrap any pixel buffer that starts with three
+ * consecutive float coordinates. A pixel with x == 0 is empty.
+ */
+struct RangeImage {
+  const float* data = NULL;   ///< x coordinate of pixel (0, 0), followed by its y and z coordinates
+  int rows = 0;               ///< number of image rows
+  int cols = 0;               ///< number of image columns
+  size_t rowStride = 0;       ///< number of floats between vertically adjacent pixels
+  size_t colStride = 0;       ///< number of floats between horizontally adjacent pixels
+  int rowStep = 1;            ///< number of image rows per scan ring (only every rowStep-th row is used)
+  float zOffset = 0;          ///< offset added to the z coordinate of every pixel
+  const uint8_t* intensity = NULL;  ///< intensity of pixel (0, 0), addressed with the same strides as data (NULL = no intensity)
+  const float* relTime = NULL;      ///< relative time of every pixel, row major (NULL = estimated from the column)
+
+  const float* pixel(const int& row, const int& col) const { return data + row * rowStride + col * colStride; }
+  bool isValid(const int& row, const int& col) const { return pixel(row, col)[0] != 0; }
+  int numberOfScanRings() const { return rowStep > 0 ? (rows + rowStep - 1) / rowStep : 0; }
+
+  /** \brief Read the coordinates of a pixel.
+   *
+   * @param row the pixel row
+   * @param col the pixel column
+   * @param point the output point (ring and relative time are left untouched)
+   */
+  void getPoint(const int& row, const int& col, PointXYZIRT& point) const
+  {
+    const float* p = pixel(row, col);
+    point.x = p[0];
+    point.y = p[1];
+    point.z = p[2] + zOffset;
+    point.intensity = intensity ? intensity[(row * rowStride + col * colStride) * sizeof(float)] : 0;
+  }
+
+  /** \brief The time of a pixel relative to the sweep start.
+   *
+   * @param row the pixel row
+   * @param col the pixel column
+   * @param scanPeriod the sweep duration, used to estimate the time from the column if no pixel times are given
+   */
+  float getRelTime(const int& row, const int& col, const float& scanPeriod) const
+  {
+    return relTime ? relTime[row * cols + col] : scanPeriod * col / cols;
+  }
+};
+
+} // end namespace loam
+
+#endif //LOAM_RANGEIMAGE_H
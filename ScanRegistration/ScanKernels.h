@@ -0,0 +1,193 @@
+#ifndef LOAM_SCANKERNELS_H
+#define LOAM_SCANKERNELS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PointTypes.h"
+
+#include "math_utils.h"
+
+
+namespace loam {
+
+
+
+/** \brief Compile-time unrolled sum over the +/- N neighbors of a coordinate.
+ *
+ * @tparam N the number of neighbors on each side
+ */
+template <int N>
+struct NeighborWindow {
+  static inline float sum(const float* v)
+  {
+    return NeighborWindow<N - 1>::sum(v) + v[N] + v[-N];
+  }
+};
+
+template <>
+struct NeighborWindow<0> {
+  static inline float sum(const float*) { return 0; }
+};
+
+
+
+/** \brief Compile-time unrolled marking of the I-th to N-th neighbors of a picked point.
+ *
+ * Marking stops at the first neighbor that is not within close distance to its predecessor.
+ */
+template <int I, int N, bool End = (I > N)>
+struct NeighborMarker {
+  static inline void forward(const PointXYZIRT* p, int* picked)
+  {
+    if (calcSquaredDiff(p[I], p[I - 1]) > 0.05) {
+      return;
+    }
+    picked[I] = 1;
+    NeighborMarker<I + 1, N>::forward(p, picked);
+  }
+
+  static inline void backward(const PointXYZIRT* p, int* picked)
+  {
+    if (calcSquaredDiff(p[-I], p[-I + 1]) > 0.05) {
+      return;
+    }
+    picked[-I] = 1;
+    NeighborMarker<I + 1, N>::backward(p, picked);
+  }
+};
+
+template <int I, int N>
+struct NeighborMarker<I, N, true> {
+  static inline void forward(const PointXYZIRT*, int*) {}
+  static inline void backward(const PointXYZIRT*, int*) {}
+};
+
+
+
+/** \brief Feature extraction kernels specialized on the curvature region.
+ *
+ * @tparam CurvatureRegion the number of surrounding points (+/- region around a point) used to calculate a point curvature
+ */
+template <int CurvatureRegion>
+struct CurvatureKernel {
+  /** \brief Calculate the curvature of all points within the given range and reset the sort indices.
+   *
+   * @param cloud the coordinates of the full resolution cloud
+   * @param startIdx the region start index
+   * @param endIdx the region end index
+   * @param curvature the output curvature buffer (one entry per region point)
+   * @param sortIndices the output sort index buffer (one entry per region point)
+   */
+  static void computeCurvature(const CloudSoA& cloud,
+                               const size_t& startIdx,
+                               const size_t& endIdx,
+                               float* curvature,
+                               size_t* sortIndices)
+  {
+    const float pointWeight = -2 * CurvatureRegion;
+    const float* x = cloud.x();
+    const float* y = cloud.y();
+    const float* z = cloud.z();
+    const size_t regionSize = endIdx - startIdx + 1;
+
+    // independent iterations over consecutive coordinates, so the loop vectorizes
+    for (size_t regionIdx = 0; regionIdx < regionSize; regionIdx++) {
+      const size_t i = startIdx + regionIdx;
+      float diffX = pointWeight * x[i] + NeighborWindow<CurvatureRegion>::sum(&x[i]);
+      float diffY = pointWeight * y[i] + NeighborWindow<CurvatureRegion>::sum(&y[i]);
+      float diffZ = pointWeight * z[i] + NeighborWindow<CurvatureRegion>::sum(&z[i]);
+
+      curvature[regionIdx] = diffX * diffX + diffY * diffY + diffZ * diffZ;
+    }
+
+    for (size_t regionIdx = 0; regionIdx < regionSize; regionIdx++) {
+      sortIndices[regionIdx] = startIdx + regionIdx;
+    }
+  }
+
+  /** \brief Mark a point and its neighbors within the curvature region as picked.
+   *
+   * @param cloud the full resolution cloud
+   * @param cloudIdx the index of the picked point in the full resolution cloud
+   * @param picked the picked flag of the picked point
+   */
+  static void markAsPicked(const PointXYZIRT* cloud,
+                           const size_t& cloudIdx,
+                           int* picked)
+  {
+    *picked = 1;
+    NeighborMarker<1, CurvatureRegion>::forward(&cloud[cloudIdx], picked);
+    NeighborMarker<1, CurvatureRegion>::backward(&cloud[cloudIdx], picked);
+  }
+};
+
+
+
+/** Curvature kernel function type. */
+typedef void (*CurvatureFunction)(const CloudSoA&, const size_t&, const size_t&, float*, size_t*);
+
+/** Neighbor marking kernel function type. */
+typedef void (*MarkAsPickedFunction)(const PointXYZIRT*, const size_t&, int*);
+
+/** The largest curvature region with a specialized kernel. */
+const int MAX_SPECIALIZED_CURVATURE_REGION = 8;
+
+/** \brief Select the specialized kernels for the given curvature region.
+ *
+ * @param curvatureRegion the curvature region
+ * @param curvatureFunction the output curvature kernel
+ * @param markAsPickedFunction the output neighbor marking kernel
+ * @return true if specialized kernels exist for the curvature region, false otherwise
+ */
+inline bool selectCurvatureKernel(const int& curvatureRegion,
+                                  CurvatureFunction& curvatureFunction,
+                                  MarkAsPickedFunction& markAsPickedFunction)
+{
+  switch (curvatureRegion) {
+#define LOAM_CURVATURE_KERNEL_CASE(N) \
+    case N: \
+      curvatureFunction = &CurvatureKernel<N>::computeCurvature; \
+      markAsPickedFunction = &CurvatureKernel<N>::markAsPicked; \
+      return true;
+    LOAM_CURVATURE_KERNEL_CASE(1)
+    LOAM_CURVATURE_KERNEL_CASE(2)
+    LOAM_CURVATURE_KERNEL_CASE(3)
+    LOAM_CURVATURE_KERNEL_CASE(4)
+    LOAM_CURVATURE_KERNEL_CASE(5)
+    LOAM_CURVATURE_KERNEL_CASE(6)
+    LOAM_CURVATURE_KERNEL_CASE(7)
+    LOAM_CURVATURE_KERNEL_CASE(8)
+#undef LOAM_CURVATURE_KERNEL_CASE
+    default:
+      curvatureFunction = NULL;
+      markAsPickedFunction = NULL;
+      return false;
+  }
+}
+
+
+
+/** \brief Per ring point counters with a compile-time ring count.
+ *
+ * @tparam NRings the number of scan rings (0 = determined at runtime)
+ */
+template <uint16_t NRings>
+struct RingCounts {
+  explicit RingCounts(const uint16_t&) { n.fill(0); }
+  uint16_t size() const { return NRings; }
+  std::array<uint32_t, NRings> n;
+};
+
+template <>
+struct RingCounts<0> {
+  explicit RingCounts(const uint16_t& nRings) : n(nRings, 0) {}
+  uint16_t size() const { return uint16_t(n.size()); }
+  std::vector<uint32_t> n;
+};
+
+} // end namespace loam
+
+#endif //LOAM_SCANKERNELS_H
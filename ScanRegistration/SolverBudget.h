@@ -0,0 +1,135 @@
+#ifndef LOAM_SOLVERBUDGET_H
+#define LOAM_SOLVERBUDGET_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+
+namespace loam {
+
+
+
+/** \brief Wall-clock budget of an iterative solver within a frame, with statistics over all frames.
+ *
+ * The clock is started at the beginning of a frame. Before every iteration the solver asks whether another
+ * iteration fits into the remaining budget, estimated by the longest iteration of the frame so far. If not, the
+ * solver stops and keeps the pose of the last completed iteration. Iterations are never interrupted, so the
+ * solver state is always consistent at cut-off.
+ *
+ * A budget of 0 disables the deadline; the statistics are still collected.
+ */
+class SolverBudget {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  /** \brief Solver statistics over all frames. */
+  struct Statistics {
+    size_t runs = 0;          ///< number of solver runs
+    size_t iterations = 0;    ///< total number of iterations
+    size_t converged = 0;     ///< number of runs that reached the convergence thresholds
+    size_t budgetHits = 0;    ///< number of runs stopped by the deadline
+    double cutOffDeltaR = 0;  ///< sum of the last rotation updates (in deg) of the runs stopped by the deadline
+    double cutOffDeltaT = 0;  ///< sum of the last translation updates (in cm) of the runs stopped by the deadline
+    double maxTime = 0;       ///< longest frame (in ms)
+  };
+
+  /** \brief Construct a new budget.
+   *
+   * @param budget the wall-clock budget per frame (in ms, 0 = unlimited)
+   */
+  explicit SolverBudget(const double& budget = 0) : _budget(budget) { start(); }
+
+  void setBudget(const double& budget) { _budget = std::max(budget, 0.0); }
+  const double& getBudget() const { return _budget; }
+  const Statistics& getStatistics() const { return _stats; }
+
+  /** \brief Start the clock of a new frame. */
+  void start()
+  {
+    _start = _iterationStart = Clock::now();
+    _maxIteration = 0;
+    _iterations = 0;
+    _hit = false;
+  }
+
+  /** \brief Check if another iteration fits into the remaining budget (call before every iteration).
+   *
+   * @return true if the iteration should be run, false if the solver has to stop
+   */
+  bool nextIteration()
+  {
+    const Clock::time_point now = Clock::now();
+    if (_iterations > 0)
+      _maxIteration = std::max(_maxIteration, milliseconds(now - _iterationStart));
+    _iterationStart = now;
+
+    if (_budget > 0 && milliseconds(now - _start) + _maxIteration > _budget) {
+      _hit = true;
+      return false;
+    }
+    _iterations++;
+    return true;
+  }
+
+  /** \brief Finish the frame and record its statistics.
+   *
+   * @param converged true if the solver reached its convergence thresholds
+   * @param deltaR the last rotation update (in deg)
+   * @param deltaT the last translation update (in cm)
+   */
+  void finish(const bool& converged, const float& deltaR, const float& deltaT)
+  {
+    _stats.runs++;
+    _stats.iterations += _iterations;
+    _stats.maxTime = std::max(_stats.maxTime, elapsed());
+    if (converged)
+      _stats.converged++;
+    if (_hit) {
+      _stats.budgetHits++;
+      _stats.cutOffDeltaR += deltaR;
+      _stats.cutOffDeltaT += deltaT;
+    }
+  }
+
+  /** \brief The time since the start of the frame (in ms). */
+  double elapsed() const { return milliseconds(Clock::now() - _start); }
+
+  /** \brief The number of iterations run in the current frame. */
+  const size_t& iterations() const { return _iterations; }
+
+  /** \brief Check if the current frame was stopped by the deadline. */
+  const bool& budgetHit() const { return _hit; }
+
+  /** \brief Print the current frame and the overall statistics. */
+  void print(std::ostream& os) const
+  {
+    os << "iterations -> " << _iterations << ", time -> " << elapsed() << " ms";
+    if (_hit)
+      os << " (budget of " << _budget << " ms hit)";
+    os << ", budget hits -> " << _stats.budgetHits << " / " << _stats.runs;
+    if (_stats.budgetHits > 0)
+      os << ", mean deltaR / deltaT at cut-off -> " << _stats.cutOffDeltaR / _stats.budgetHits
+         << " / " << _stats.cutOffDeltaT / _stats.budgetHits;
+    os << ", converged -> " << _stats.converged << " / " << _stats.runs;
+  }
+
+private:
+  static double milliseconds(const Clock::duration& d)
+  {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+
+  double _budget;                       ///< budget per frame (in ms, 0 = unlimited)
+  Clock::time_point _start;             ///< start of the current frame
+  Clock::time_point _iterationStart;    ///< start of the current iteration
+  double _maxIteration;                 ///< longest iteration of the current frame (in ms)
+  size_t _iterations;                   ///< iterations of the current frame
+  bool _hit;                            ///< the current frame was stopped by the deadline
+  Statistics _stats;                    ///< statistics over all frames
+};
+
+} // end namespace loam
+
+#endif //LOAM_SOLVERBUDGET_H
@@ -0,0 +1,190 @@
+#ifndef LOAM_SPSCRINGBUFFER_H
+#define LOAM_SPSCRINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+namespace loam {
+
+
+
+/** \brief Lock-free single producer / single consumer ring buffer, e.g. for a live NAV / IMU stream.
+ *
+ * One thread pushes elements, another one reads and pops them; neither of them ever blocks. The capacity is
+ * rounded up to a power of two, so slots are addressed by masking free running counters. Elements are moved in
+ * and out, so move-only types are supported.
+ *
+ * Besides pop(), the consumer can read all published elements in place (operator[]) and search them by time
+ * stamp (lowerBound()), so it can interpolate between the two elements around a time without copying the
+ * history. Published elements are not touched by the producer until the consumer pops them.
+ *
+ * @tparam T The buffer element type.
+ */
+template <class T>
+class SpscRingBuffer {
+public:
+  /** \brief Construct a new buffer.
+   *
+   * @param capacity the minimum capacity (rounded up to the next power of two)
+   */
+  explicit SpscRingBuffer(const size_t& capacity = 1024)
+        : _head(0),
+          _tail(0),
+          _tailCache(0),
+          _headCache(0)
+  {
+    size_t roundedCapacity = 1;
+    while (roundedCapacity < capacity)
+      roundedCapacity <<= 1;
+    _mask = roundedCapacity - 1;
+    _buffer.reset(new Slot[roundedCapacity]);
+  }
+
+  ~SpscRingBuffer()
+  {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    for (size_t i = _tail.load(std::memory_order_relaxed); i != head; i++)
+      element(i).~T();
+  }
+
+  SpscRingBuffer(const SpscRingBuffer&) = delete;
+  SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+  /** \brief Retrieve the buffer capacity. */
+  size_t capacity() const { return _mask + 1; }
+
+  /** \brief Retrieve the number of published elements (exact for the consumer, a lower bound for the producer). */
+  size_t size() const
+  {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+
+  /** \brief Check if the buffer is empty. */
+  bool empty() const { return size() == 0; }
+
+
+  /** \brief Construct a new element in place (producer only).
+   *
+   * @return true if the element was pushed, false if the buffer is full
+   */
+  template <class... Args>
+  bool emplace(Args&&... args)
+  {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tailCache > _mask) {
+      // the cached tail is only refreshed when the buffer seems full
+      _tailCache = _tail.load(std::memory_order_acquire);
+      if (head - _tailCache > _mask)
+        return false;
+    }
+
+    new (&_buffer[head & _mask]) T(std::forward<Args>(args)...);
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** \brief Push a copy of an element (producer only). */
+  bool push(const T& value) { return emplace(value); }
+
+  /** \brief Push an element by moving it (producer only). */
+  bool push(T&& value) { return emplace(std::move(value)); }
+
+
+  /** \brief Move the oldest element out of the buffer (consumer only).
+   *
+   * @param value the output element
+   * @return true if an element was popped, false if the buffer is empty
+   */
+  bool pop(T& value)
+  {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    if (!available(tail, 1))
+      return false;
+
+    value = std::move(element(tail));
+    element(tail).~T();
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** \brief Drop the oldest elements (consumer only).
+   *
+   * @param n the number of elements to drop (at most the number of published elements is dropped)
+   */
+  void pop(size_t n = 1)
+  {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    const size_t head = _headCache = _head.load(std::memory_order_acquire);
+    if (n > head - tail)
+      n = head - tail;
+
+    for (size_t i = tail; i != tail + n; i++)
+      element(i).~T();
+    _tail.store(tail + n, std::memory_order_release);
+  }
+
+  /** \brief Retrieve the i-th published element, 0 being the oldest one (consumer only).
+   *
+   * The index has to be smaller than a preceding size() of the consumer.
+   */
+  T& operator[](const size_t& i) { return element(_tail.load(std::memory_order_relaxed) + i); }
+  const T& operator[](const size_t& i) const { return element(_tail.load(std::memory_order_relaxed) + i); }
+
+  /** \brief Find the first published element with a time stamp not less than the given one (consumer only).
+   *
+   * The elements have to be pushed in time stamp order.
+   *
+   * @param stamp the time stamp to search
+   * @param stampOf functor returning the time stamp of an element
+   * @return the index of the element (for operator[]), or the number of searched elements if all of them are older
+   */
+  template <class Stamp, class StampOf>
+  size_t lowerBound(const Stamp& stamp, StampOf stampOf) const
+  {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t first = 0, count = _head.load(std::memory_order_acquire) - tail;
+    while (count > 0) {
+      const size_t step = count / 2;
+      if (stampOf(element(tail + first + step)) < stamp) {
+        first += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return first;
+  }
+
+private:
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+  /** Check if n elements are published from the given tail on, refreshing the cached head only if needed. */
+  bool available(const size_t& tail, const size_t& n)
+  {
+    if (_headCache - tail >= n)
+      return true;
+    _headCache = _head.load(std::memory_order_acquire);
+    return _headCache - tail >= n;
+  }
+
+  T& element(const size_t& counter) { return *reinterpret_cast<T*>(&_buffer[counter & _mask]); }
+  const T& element(const size_t& counter) const { return *reinterpret_cast<const T*>(&_buffer[counter & _mask]); }
+
+  static const size_t CACHE_LINE = 64;
+
+  std::unique_ptr<Slot[]> _buffer;                  ///< element slots
+  size_t _mask;                                     ///< capacity - 1
+  alignas(CACHE_LINE) std::atomic<size_t> _head;    ///< number of pushed elements (written by the producer)
+  alignas(CACHE_LINE) std::atomic<size_t> _tail;    ///< number of popped elements (written by the consumer)
+  alignas(CACHE_LINE) size_t _tailCache;            ///< last tail seen by the producer
+  alignas(CACHE_LINE) size_t _headCache;            ///< last head seen by the consumer
+};
+
+} // end namespace loam
+
+#endif //LOAM_SPSCRINGBUFFER_H
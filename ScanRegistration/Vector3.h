@@ -4,6 +4,8 @@
 
 #include <pcl/point_types.h>
 
+#include "PointTypes.h"
+
 
 namespace loam {
 
@@ -25,6 +27,9 @@ public:
   Vector3(const pcl::PointXYZI &p)
       : Eigen::Vector4f(p.x, p.y, p.z, 0) {}
 
+  Vector3(const PointXYZIRT &p)
+      : Eigen::Vector4f(p.x, p.y, p.z, 0) {}
+
   template<typename OtherDerived>
   Vector3 &operator=(const Eigen::MatrixBase <OtherDerived> &rhs) {
     this->Eigen::Vector4f::operator=(rhs);
@@ -45,6 +50,13 @@ public:
     return *this;
   }
 
+  Vector3 &operator=(const PointXYZIRT &rhs) {
+    x() = rhs.x;
+    y() = rhs.y;
+    z() = rhs.z;
+    return *this;
+  }
+
   float x() const { return (*this)(0); }
 
   float y() const { return (*this)(1); }
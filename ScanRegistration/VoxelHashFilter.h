@@ -0,0 +1,239 @@
+#ifndef LOAM_VOXELHASHFILTER_H
+#define LOAM_VOXELHASHFILTER_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+
+namespace loam {
+
+
+
+/** \brief Voxel grid down size filter based on a hashed grid.
+ *
+ * Points are binned into voxels in a single pass over a contiguous point buffer. Unlike pcl::VoxelGrid or
+ * pcl::UniformSampling no search structure is built and the input cloud is not copied. The hash tables and
+ * voxel buffers are kept between calls, so a long-lived filter instance does not allocate once it is warm.
+ *
+ * Only x, y and z are averaged in centroid mode. All other fields (e.g. the scan ring and relative time) are
+ * taken from the first point of a voxel, so they remain valid after filtering.
+ *
+ * @tparam PointT The point type.
+ */
+template <class PointT>
+class VoxelHashFilter {
+public:
+  /** Representative point of a voxel. */
+  enum Mode {
+    CENTROID,     ///< average position of all points within the voxel
+    FIRST_POINT   ///< first point (in input order) within the voxel
+  };
+
+  /** \brief Construct a new voxel hash filter.
+   *
+   * @param leafSize the voxel edge length
+   * @param mode the representative point selection mode
+   * @param nPartitions the number of partitions processed in parallel (1 = serial)
+   */
+  VoxelHashFilter(const float& leafSize = 0.2f,
+                  const Mode& mode = CENTROID,
+                  const int& nPartitions = 1)
+        : _leafSize(leafSize),
+          _mode(mode)
+  {
+    setPartitions(nPartitions);
+  };
+
+  void setLeafSize(const float& leafSize) { _leafSize = leafSize; }
+  void setMode(const Mode& mode) { _mode = mode; }
+
+  /** \brief Set the number of partitions processed in parallel.
+   *
+   * Points are partitioned by their voxel hash, so every voxel is owned by exactly one partition and the
+   * output is deterministic for a given partition count.
+   *
+   * @param nPartitions the number of partitions (1 = serial)
+   */
+  void setPartitions(const int& nPartitions) { _partitions.resize(nPartitions > 0 ? nPartitions : 1); }
+
+  const float& getLeafSize() const { return _leafSize; }
+  const Mode& getMode() const { return _mode; }
+  size_t getPartitions() const { return _partitions.size(); }
+
+  /** \brief Down size the given cloud.
+   *
+   * @param cloudIn the input cloud
+   * @param cloudOut the output cloud (must not be the input cloud)
+   */
+  void filter(const pcl::PointCloud<PointT>& cloudIn, pcl::PointCloud<PointT>& cloudOut)
+  {
+    filter(cloudIn.points.data(), cloudIn.points.size(), cloudOut);
+  }
+
+  /** \brief Down size the given contiguous point buffer.
+   *
+   * @param points the first input point
+   * @param nPoints the number of input points
+   * @param cloudOut the output cloud (must not overlap the input buffer)
+   */
+  void filter(const PointT* points, const size_t& nPoints, pcl::PointCloud<PointT>& cloudOut)
+  {
+    cloudOut.points.clear();
+    cloudOut.height = 1;
+    cloudOut.is_dense = true;
+
+    // compute voxel keys, non-finite points are marked invalid
+    const float invLeaf = 1.0f / _leafSize;
+    _keys.resize(nPoints);
+    for (size_t i = 0; i < nPoints; i++) {
+      const PointT& p = points[i];
+      if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+        _keys[i] = INVALID_KEY;
+        continue;
+      }
+      _keys[i] = toKey(int64_t(std::floor(p.x * invLeaf)),
+                       int64_t(std::floor(p.y * invLeaf)),
+                       int64_t(std::floor(p.z * invLeaf)));
+    }
+
+    // bin points per partition
+    const int nPartitions = int(_partitions.size());
+    if (nPartitions == 1) {
+      binPartition(_partitions[0], points, nPoints, 0, 1);
+    } else {
+#pragma omp parallel for num_threads(nPartitions) schedule(static, 1)
+      for (int p = 0; p < nPartitions; p++) {
+        binPartition(_partitions[p], points, nPoints, p, nPartitions);
+      }
+    }
+
+    // emit one point per voxel
+    size_t nVoxels = 0;
+    for (auto const& part : _partitions) {
+      nVoxels += part.voxels.size();
+    }
+    cloudOut.points.resize(nVoxels);
+
+    size_t outIdx = 0;
+    for (auto& part : _partitions) {
+      for (auto const& voxel : part.voxels) {
+        PointT& po = cloudOut.points[outIdx++];
+        po = points[voxel.first];
+        if (_mode == CENTROID && voxel.count > 1) {
+          const double invCount = 1.0 / voxel.count;
+          po.x = float(voxel.x * invCount);
+          po.y = float(voxel.y * invCount);
+          po.z = float(voxel.z * invCount);
+        }
+      }
+    }
+
+    cloudOut.width = uint32_t(nVoxels);
+  }
+
+private:
+  /** Accumulated voxel state. */
+  struct Voxel {
+    double x, y, z;   ///< coordinate sums
+    uint32_t count;   ///< number of points
+    uint32_t first;   ///< index of the first point
+    size_t slot;      ///< hash table slot occupied by this voxel
+  };
+
+  /** Hash table and voxels of one partition. */
+  struct Partition {
+    std::vector<uint64_t> slotKeys;    ///< voxel key per hash table slot
+    std::vector<uint32_t> slotVoxel;   ///< voxel index per hash table slot (EMPTY_SLOT if unused)
+    std::vector<Voxel> voxels;         ///< voxels in order of first appearance
+  };
+
+  static const uint64_t INVALID_KEY = ~uint64_t(0);
+  static const uint32_t EMPTY_SLOT = ~uint32_t(0);
+
+  /** \brief Pack integer voxel coordinates into a single key (21 bit per axis). */
+  static inline uint64_t toKey(const int64_t& i, const int64_t& j, const int64_t& k)
+  {
+    const int64_t offset = int64_t(1) << 20;
+    const uint64_t mask = (uint64_t(1) << 21) - 1;
+    return (uint64_t(i + offset) & mask)
+           | ((uint64_t(j + offset) & mask) << 21)
+           | ((uint64_t(k + offset) & mask) << 42);
+  }
+
+  static inline uint64_t hashKey(const uint64_t& key)
+  {
+    return (key * 0x9E3779B97F4A7C15ull) >> 17;
+  }
+
+  /** \brief Bin all points whose voxel belongs to the given partition. */
+  void binPartition(Partition& part, const PointT* points, const size_t& nPoints, const int& partIdx, const int& nPartitions)
+  {
+    // release the slots of the previous call
+    for (auto const& voxel : part.voxels) {
+      part.slotVoxel[voxel.slot] = EMPTY_SLOT;
+    }
+    part.voxels.clear();
+
+    // the hash does not balance the partitions, so count the points of this one: there are at most as many voxels
+    // as points, and a table of twice that size keeps the load factor below 0.5, so a probe always ends
+    size_t nPartPoints = 0;
+    for (size_t i = 0; i < nPoints; i++) {
+      if (_keys[i] != INVALID_KEY && (nPartitions == 1 || int(hashKey(_keys[i]) % nPartitions) == partIdx)) {
+        nPartPoints++;
+      }
+    }
+
+    size_t reqSlots = 64;
+    while (reqSlots < 2 * nPartPoints) {
+      reqSlots <<= 1;
+    }
+    if (part.slotVoxel.size() < reqSlots) {
+      part.slotKeys.assign(reqSlots, 0);
+      part.slotVoxel.assign(reqSlots, uint32_t(EMPTY_SLOT));
+    }
+    const size_t slotMask = part.slotVoxel.size() - 1;
+
+    for (size_t i = 0; i < nPoints; i++) {
+      const uint64_t key = _keys[i];
+      if (key == INVALID_KEY) {
+        continue;
+      }
+
+      const uint64_t hash = hashKey(key);
+      if (nPartitions > 1 && int(hash % nPartitions) != partIdx) {
+        continue;
+      }
+
+      // linear probing
+      size_t slot = (hash / nPartitions) & slotMask;
+      while (part.slotVoxel[slot] != EMPTY_SLOT && part.slotKeys[slot] != key) {
+        slot = (slot + 1) & slotMask;
+      }
+
+      if (part.slotVoxel[slot] == EMPTY_SLOT) {
+        part.slotKeys[slot] = key;
+        part.slotVoxel[slot] = uint32_t(part.voxels.size());
+        part.voxels.push_back({ 0.0, 0.0, 0.0, 0, uint32_t(i), slot });
+      }
+
+      Voxel& voxel = part.voxels[part.slotVoxel[slot]];
+      voxel.x += points[i].x;
+      voxel.y += points[i].y;
+      voxel.z += points[i].z;
+      voxel.count++;
+    }
+  }
+
+private:
+  float _leafSize;                      ///< voxel edge length
+  Mode _mode;                           ///< representative point selection mode
+  std::vector<uint64_t> _keys;          ///< voxel key per input point
+  std::vector<Partition> _partitions;   ///< hash tables and voxels per partition
+};
+
+} // end namespace loam
+
+#endif //LOAM_VOXELHASHFILTER_H
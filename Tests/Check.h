@@ -0,0 +1,30 @@
+#ifndef LOAM_TESTS_CHECK_H
+#define LOAM_TESTS_CHECK_H
+
+#include <cstdio>
+
+
+namespace loam {
+namespace test {
+
+/** \brief The number of failed checks so far, returned by the test main(). */
+inline int& failures()
+{
+  static int nFailures = 0;
+  return nFailures;
+}
+
+} // end namespace test
+} // end namespace loam
+
+
+/** \brief Report and count a failed condition, the test goes on. */
+#define LOAM_CHECK(condition)                                                               \
+  do {                                                                                      \
+    if (!(condition)) {                                                                     \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);    \
+      loam::test::failures()++;                                                             \
+    }                                                                                       \
+  } while (0)
+
+#endif //LOAM_TESTS_CHECK_H
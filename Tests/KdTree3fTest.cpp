@@ -0,0 +1,129 @@
+#include "Check.h"
+#include "../LaserMapping/KdTree3f.h"
+#include "../LaserMapping/nanoflann.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+struct Point
+{
+   float x, y, z;
+};
+
+float squaredDistance(const Point& a, const float* b)
+{
+   const float dx = a.x - b[0], dy = a.y - b[1], dz = a.z - b[2];
+   return dx * dx + dy * dy + dz * dz;
+}
+
+bool close(const float& a, const float& b)
+{
+   return std::fabs(a - b) <= 1e-5f * std::max(1.0f, std::fabs(b));
+}
+
+/** Compare the k nearest neighbor and radius searches of a tree with a linear scan over the indexed points. */
+void checkSearches(const std::vector<Point>& points, const std::vector<int>* indices, const size_t& leafSize,
+                   std::mt19937& rng)
+{
+   const size_t n = indices ? indices->size() : points.size();
+   loam::KdTree3f tree(leafSize);
+   tree.build(points.data(), indices ? indices->data() : NULL, n);
+   LOAM_CHECK(tree.size() == n);
+
+   std::uniform_real_distribution<float> coordinate(-12, 12);
+   for (int q = 0; q < 50; q++)
+   {
+      const float query[3] = { coordinate(rng), coordinate(rng), coordinate(rng) };
+
+      // reference: squared distances of all indexed points, sorted
+      std::vector<std::pair<float, int> > reference(n);
+      for (size_t i = 0; i < n; i++)
+      {
+         reference[i] = std::make_pair(squaredDistance(points[indices ? (*indices)[i] : i], query), int(i));
+      }
+      std::sort(reference.begin(), reference.end());
+
+      for (int k : { 1, 5 })
+      {
+         std::vector<int> kIndices(k, -1);
+         std::vector<float> kDists(k);
+         nanoflann::KNNResultSet<float, int> knn(k);
+         knn.init(kIndices.data(), kDists.data());
+         tree.search(query, knn);
+
+         LOAM_CHECK(knn.size() == std::min(size_t(k), n));
+         for (size_t i = 0; i < knn.size(); i++)
+         {
+            LOAM_CHECK(close(kDists[i], reference[i].first));
+            LOAM_CHECK(kIndices[i] >= 0 && size_t(kIndices[i]) < n);
+            if (kIndices[i] >= 0 && size_t(kIndices[i]) < n)
+            {
+               // reported indices are positions in the indices vector
+               LOAM_CHECK(close(kDists[i], squaredDistance(points[indices ? (*indices)[kIndices[i]] : kIndices[i]], query)));
+            }
+         }
+      }
+
+      // the radius of RadiusResultSet is a squared distance
+      const float radius = 16;
+      std::vector<std::pair<int, float> > found;
+      nanoflann::RadiusResultSet<float, int> within(radius, found);
+      tree.search(query, within);
+      size_t nExpected = 0;
+      while (nExpected < n && reference[nExpected].first < radius)
+      {
+         nExpected++;
+      }
+      LOAM_CHECK(found.size() == nExpected);
+   }
+}
+
+} // end anonymous namespace
+
+
+int main()
+{
+   std::mt19937 rng(42);
+   std::uniform_real_distribution<float> coordinate(-10, 10);
+
+   for (size_t n : { 0, 1, 5, 16, 17, 100, 1000 })
+   {
+      std::vector<Point> points(n);
+      for (Point& p : points)
+      {
+         p = Point{ coordinate(rng), coordinate(rng), coordinate(rng) };
+      }
+
+      // every other point, in reverse order
+      std::vector<int> indices;
+      for (int i = int(n) - 1; i >= 0; i -= 2)
+      {
+         indices.push_back(i);
+      }
+
+      for (size_t leafSize : { 1, 4, 16, 64 })
+      {
+         checkSearches(points, NULL, leafSize, rng);
+         checkSearches(points, &indices, leafSize, rng);
+      }
+   }
+
+   // a flat cloud: the split axis has no extent along z
+   std::vector<Point> plane;
+   for (int i = 0; i < 30; i++)
+   {
+      for (int j = 0; j < 30; j++)
+      {
+         plane.push_back(Point{ float(i), float(j), 0 });
+      }
+   }
+   checkSearches(plane, NULL, 8, rng);
+
+   return loam::test::failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include "Check.h"
+#include "../LaserMapping/MapFile.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using loam::CubeKey;
+using loam::CubeMap;
+using loam::PointXYZIRT;
+
+namespace
+{
+
+/** A cloud of n points whose fields are derived from a seed. */
+void fillCloud(const int& n, const int& seed, CubeMap::Cloud& cloud)
+{
+   cloud.clear();
+   for (int i = 0; i < n; i++)
+   {
+      PointXYZIRT p;
+      p.x = seed + i;
+      p.y = seed - 0.5f * i;
+      p.z = 0.25f * i;
+      p.intensity = float(i % 7);
+      p.relTime = 0.001f * i;
+      p.ring = uint16_t(i % 64);
+      cloud.push_back(p);
+   }
+}
+
+bool sameCloud(const CubeMap::Cloud& a, const CubeMap::Cloud& b)
+{
+   if (a.points.size() != b.points.size() || a.width != b.points.size() || a.height != 1)
+   {
+      return false;
+   }
+   for (size_t i = 0; i < a.points.size(); i++)
+   {
+      const PointXYZIRT& p = a.points[i];
+      const PointXYZIRT& q = b.points[i];
+      if (p.x != q.x || p.y != q.y || p.z != q.z || p.intensity != q.intensity || p.relTime != q.relTime
+          || p.ring != q.ring)
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+/** The cube expected for a key, in memory and in the stored cubes alike. */
+void expectedCube(const CubeKey& key, CubeMap::Cube& cube)
+{
+   const int seed = key.i * 100 + key.j * 10 + key.k;
+   fillCloud(key.i == 0 ? 0 : 3 + key.i, seed, *cube.corner);
+   fillCloud(5 + key.j * key.j, -seed, *cube.surf);
+}
+
+} // end anonymous namespace
+
+
+int main()
+{
+   char dir[] = "/tmp/loam_map_file_test_XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      std::perror("mkdtemp");
+      return 1;
+   }
+   const std::string path = std::string(dir) + "/test.map";
+
+   CubeMap map(50);
+   const std::vector<CubeKey> inMemory = { { 0, 0, 0 }, { 1, -2, 3 }, { -4, 5, -6 } };
+   for (const CubeKey& key : inMemory)
+   {
+      expectedCube(key, map.cube(key));
+   }
+   const std::vector<CubeKey> stored = { { 7, 7, 7 }, { -1, 0, 2 } };
+   CubeMap::Cloud surround;
+   fillCloud(123, 9, surround);
+
+   // the stored cubes are loaded one at a time while the file is written
+   size_t nLoaded = 0;
+   const bool saved = loam::saveMapFile(path, map, surround, stored,
+                                        [&nLoaded](const CubeKey& key, CubeMap::Cube& cube)
+                                        {
+                                           nLoaded++;
+                                           expectedCube(key, cube);
+                                           return true;
+                                        });
+   LOAM_CHECK(saved);
+   LOAM_CHECK(nLoaded == stored.size());
+   LOAM_CHECK(map.size() == inMemory.size());
+
+   CubeMap loaded(1);
+   CubeMap::Cloud loadedSurround;
+   LOAM_CHECK(loam::loadMapFile(path, loaded, loadedSurround));
+   LOAM_CHECK(loaded.getCubeSize() == 50);
+   LOAM_CHECK(loaded.size() == inMemory.size() + stored.size());
+   LOAM_CHECK(sameCloud(loadedSurround, surround));
+
+   std::vector<CubeKey> all = inMemory;
+   all.insert(all.end(), stored.begin(), stored.end());
+   for (const CubeKey& key : all)
+   {
+      CubeMap::Cube expected;
+      expectedCube(key, expected);
+      const CubeMap::Cube* cube = loaded.find(key);
+      LOAM_CHECK(cube != NULL);
+      if (cube)
+      {
+         LOAM_CHECK(sameCloud(*cube->corner, *expected.corner));
+         LOAM_CHECK(sameCloud(*cube->surf, *expected.surf));
+      }
+   }
+
+   // a stored cube that cannot be loaded fails the save and leaves the previous file alone
+   LOAM_CHECK(!loam::saveMapFile(path, map, surround, stored,
+                                 [](const CubeKey&, CubeMap::Cube&) { return false; }));
+   CubeMap reloaded;
+   LOAM_CHECK(loam::loadMapFile(path, reloaded, loadedSurround));
+   LOAM_CHECK(reloaded.size() == all.size());
+
+   // a truncated file is rejected and the output map is unchanged
+   LOAM_CHECK(truncate(path.c_str(), 200) == 0);
+   LOAM_CHECK(!loam::loadMapFile(path, reloaded, loadedSurround));
+   LOAM_CHECK(reloaded.size() == all.size());
+
+   std::remove(path.c_str());
+   rmdir(dir);
+   return loam::test::failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#include "Check.h"
+#include "../ScanRegistration/SpscRingBuffer.h"
+
+#include <memory>
+#include <thread>
+
+using loam::SpscRingBuffer;
+
+namespace
+{
+
+struct Stamped
+{
+   long long stamp;
+};
+
+/** Counts its live instances, to check that the buffer destroys what it holds. */
+struct Counted
+{
+   static int alive;
+   Counted() { alive++; }
+   Counted(const Counted&) { alive++; }
+   ~Counted() { alive--; }
+};
+
+int Counted::alive = 0;
+
+} // end anonymous namespace
+
+
+int main()
+{
+   // capacity is rounded up to a power of two
+   {
+      SpscRingBuffer<int> buffer(5);
+      LOAM_CHECK(buffer.capacity() == 8);
+      LOAM_CHECK(buffer.empty());
+   }
+
+   // many wraparounds: fill, read in place, search, drop, refill
+   {
+      SpscRingBuffer<Stamped> buffer(8);
+      const auto stampOf = [](const Stamped& s) { return s.stamp; };
+      long long next = 0, oldest = 0;
+      for (int round = 0; round < 100; round++)
+      {
+         while (buffer.push(Stamped{ next * 10 }))
+         {
+            next++;
+         }
+         LOAM_CHECK(buffer.size() == buffer.capacity());
+
+         for (size_t i = 0; i < buffer.size(); i++)
+         {
+            LOAM_CHECK(buffer[i].stamp == (oldest + (long long)i) * 10);
+         }
+         LOAM_CHECK(buffer.lowerBound(oldest * 10, stampOf) == 0);
+         LOAM_CHECK(buffer.lowerBound(oldest * 10 + 1, stampOf) == 1);
+         LOAM_CHECK(buffer.lowerBound((oldest + 5) * 10, stampOf) == 5);
+         LOAM_CHECK(buffer.lowerBound(next * 10, stampOf) == buffer.size());
+
+         // drop a varying number of elements, so the tail moves around the ring
+         const size_t nDrop = 1 + round % 7;
+         buffer.pop(nDrop);
+         oldest += nDrop;
+         Stamped popped;
+         LOAM_CHECK(buffer.pop(popped) && popped.stamp == oldest * 10);
+         oldest++;
+         LOAM_CHECK(buffer.size() == size_t(next - oldest));
+      }
+
+      // pop(n) drops at most the published elements
+      buffer.pop(100);
+      LOAM_CHECK(buffer.empty());
+      Stamped popped;
+      LOAM_CHECK(!buffer.pop(popped));
+   }
+
+   // move-only elements
+   {
+      SpscRingBuffer<std::unique_ptr<int> > buffer(4);
+      for (int i = 0; i < 20; i++)
+      {
+         LOAM_CHECK(buffer.push(std::unique_ptr<int>(new int(i))));
+         std::unique_ptr<int> value;
+         LOAM_CHECK(buffer.pop(value) && value && *value == i);
+      }
+   }
+
+   // remaining elements are destroyed with the buffer
+   {
+      {
+         SpscRingBuffer<Counted> buffer(4);
+         for (int i = 0; i < 6; i++)
+         {
+            buffer.emplace();
+            if (i % 2)
+            {
+               buffer.pop(1);
+            }
+         }
+         LOAM_CHECK(Counted::alive == 3);
+      }
+      LOAM_CHECK(Counted::alive == 0);
+   }
+
+   // one producer and one consumer thread: every element arrives once and in order
+   {
+      const long long nElements = 200000;
+      SpscRingBuffer<long long> buffer(64);
+      std::thread producer([&buffer, nElements]()
+      {
+         for (long long i = 0; i < nElements; i++)
+         {
+            while (!buffer.push(i))
+            {
+               std::this_thread::yield();
+            }
+         }
+      });
+
+      long long expected = 0;
+      bool ordered = true;
+      while (expected < nElements)
+      {
+         long long value;
+         if (buffer.pop(value))
+         {
+            ordered = ordered && value == expected;
+            expected++;
+         }
+         else
+         {
+            std::this_thread::yield();
+         }
+      }
+      producer.join();
+      LOAM_CHECK(ordered);
+      LOAM_CHECK(buffer.empty());
+   }
+
+   return loam::test::failures() == 0 ? 0 : 1;
+}
@@ -2,10 +2,33 @@
 #include "./ScanRegistration/MultiScanRegistration.h"
 #include "./LaserOdometry/LaserOdometry.h"
 #include "./LaserMapping/LaserMapping.h"
+#include "./ScanRegistration/FeatureBudgetController.h"
+#include "./ScanRegistration/SpscRingBuffer.h"
 
 #include <pcl/common/transforms.h>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
 
 #define VIEW_MAP
+//#define RANGE_IMAGE_FEATURES  /* extract features on a range image organized by laser beam and firing instead of binning the points into rings */
+//#define STREAMING_FEATURES    /* extract features sector by sector while the blocks of a frame are read */
+
+#define SECTORS_PER_FRM     6   /* number of azimuth sectors per frame in streaming mode */
+
+#define LOAM_TARGET_TIME    80  /* target time of feature extraction, odometry and mapping per frame (ms) */
+//#define LOAM_SOLVER_BUDGET  40  /* wall-clock budget of the odometry and of the mapping solver per frame (ms), stop early with the last completed iteration */
+//#define LIVE_NAV              /* read the NAV file in a separate thread, the poses are handed over through a lock-free queue */
+#define NAV_WINDOW          10000   /* NAV poses after the scan time handed to LOAM in live mode (ms), covers the mapping prefetch horizon */
+//#define PROJECTIVE_ODOMETRY   /* odometry correspondences from the last feature clouds organized as range images instead of KD-trees */
+//#define MAP_TILE_DIR  "/tmp/loam_tiles"   /* keep at most MAP_MAX_CUBES map cubes in memory, spill the others to this directory */
+#define MAP_MAX_CUBES       256
+//#define MAP_FILE  "/tmp/loam.map"   /* start from this map file if it exists, save the map to it at the end */
+//#define LOCALIZATION_ONLY   /* only localize against the map of MAP_FILE, the map is not extended nor saved */
+
+#if defined(LOCALIZATION_ONLY) && !defined(MAP_FILE)
+#error "LOCALIZATION_ONLY needs the map of MAP_FILE"
+#endif
 
 TRANSINFO	calibInfo;
 
@@ -24,6 +47,12 @@ DMAP	gm, ggm;
 ONEDSVFRAME	*onefrm;
 ONEDSVFRAME	*originFrm;
 std::vector<NAVDATA> nav;
+#ifdef LIVE_NAV
+loam::SpscRingBuffer<NAVDATA> navQueue(4096);   /* NAV reader thread -> LOAM */
+std::atomic<bool> navDone(false);
+std::atomic<bool> navStop(false);
+std::thread navThread;
+#endif
 std::list<point2d> trajList;
 
 /* loamֱ */
@@ -38,19 +67,41 @@ pcl::visualization::PCLVisualizer viewer("PointCloud Viewer"); /* 
 bool is_first_visualization = true;
 #endif
 
-pcl::PointCloud<pcl::PointXYZI> cornerPointsSharp;      ///< sharp corner points cloud
-pcl::PointCloud<pcl::PointXYZI> cornerPointsLessSharp;  ///< less sharp corner points cloud
-pcl::PointCloud<pcl::PointXYZI> surfPointsFlat;         ///< flat surface points cloud
-pcl::PointCloud<pcl::PointXYZI> surfPointsLessFlat;     ///< less flat surface points cloud
+pcl::PointCloud<loam::PointXYZIRT> cornerPointsSharp;      ///< sharp corner points cloud
+pcl::PointCloud<loam::PointXYZIRT> cornerPointsLessSharp;  ///< less sharp corner points cloud
+pcl::PointCloud<loam::PointXYZIRT> surfPointsFlat;         ///< flat surface points cloud
+pcl::PointCloud<loam::PointXYZIRT> surfPointsLessFlat;     ///< less flat surface points cloud
+
+loam::MultiScanRegistration multiScan;
+
+#ifdef RANGE_IMAGE_FEATURES
+/* the two lines of a block pair are the upper and lower laser block of one firing */
+#define BEAMS_PER_FIRING    (PNTS_PER_LINE*2)
+#define FIRINGS_PER_FRM     (BKNUM_PER_FRM*LINES_PER_BLK/2)
+
+point3fi ringImage[BEAMS_PER_FIRING*FIRINGS_PER_FRM];   /* row: scan ring, column: firing */
+float ringRelTime[BEAMS_PER_FIRING*FIRINGS_PER_FRM];    /* time of every pixel relative to the frame start (s) */
+#endif
+
+/* adapts the feature limits of multiScan to the measured LOAM time per frame */
+loam::FeatureBudgetController featureBudget(multiScan.config(), LOAM_TARGET_TIME);
+double loamFrameTime = 0; /* LOAM time of the current frame (ms) */
+
+/* add the time since start to the LOAM time of the current frame */
+void AddLoamTime (const std::chrono::steady_clock::time_point& start)
+{
+    loamFrameTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
 loam::LaserOdometry laserOdom(0.1);
 
 loam::LaserMapping laserMapping(0.1);
 
-pcl::PointCloud<pcl::PointXYZI>::Ptr laserCloudMap(new pcl::PointCloud<pcl::PointXYZI>); /* ͼ */
+pcl::PointCloud<loam::PointXYZIRT>::Ptr laserCloudMap(new pcl::PointCloud<loam::PointXYZIRT>); /* ͼ */
 
 
 class PointCloudViewer;
+void ExtractFeatures ();
 
 bool LoadCalibFile (char *szFile)
 {
@@ -131,47 +182,66 @@ void SmoothingData ()
 	}
 }
 
-void CorrectPoints ()
+Eigen::Affine3d frmTarInv;		//T_tar^{-1} of the current frame
+Eigen::Affine3d frmCalib;		//[R_calib | SHV_calib]
+
+void PrepareBlockTransforms ()
 {
-	MAT2D	rot1, rot2;
+	//the parts of BlockTransform shared by all blocks of a frame, once block 0 is read
+	frmTarInv = (Eigen::Translation3d (onefrm->dsv[0].shv.x, onefrm->dsv[0].shv.y, onefrm->dsv[0].shv.z)
+				 * Eigen::AngleAxisd (onefrm->dsv[0].ang.z, Eigen::Vector3d::UnitZ ())).inverse ();
+
+	frmCalib = Eigen::Affine3d::Identity ();
+	for (int r=0; r<3; r++) {
+		for (int c=0; c<3; c++)
+			frmCalib.linear ()(r,c) = calibInfo.rot[r][c];
+	}
+	frmCalib.translation () << calibInfo.shv.x, calibInfo.shv.y, calibInfo.shv.z;
+}
 
-	//transform points to the vehicle frame of onefrm->dsv[0]
+Eigen::Matrix<float, 3, 4> BlockTransform (int i)
+{
+	//transform of block i to the leveled vehicle frame of onefrm->dsv[0]
 	//src: block i; tar: block 0
+	//p' = T_tar^{-1}*T_src*(R_calib*p+SHV_calib), T_src = [Rz_src*R_src | SHV_src], T_tar = [Rz_tar | SHV_tar]
+	ONEDSVDATA *blk = &onefrm->dsv[i];
 
-    //rot2: R_tar^{-1}
-	rot2[0][0] = cos (-onefrm->dsv[0].ang.z);
-	rot2[0][1] = -sin (-onefrm->dsv[0].ang.z);
-	rot2[1][0] = sin (-onefrm->dsv[0].ang.z);
-    rot2[1][1] = cos (-onefrm->dsv[0].ang.z);
-
-	for (int i=1; i<BKNUM_PER_FRM; i++) {
-		for (int j=0; j<PTNUM_PER_BLK; j++) {
+	Eigen::Affine3d src = Eigen::Affine3d::Identity ();
+	for (int r=0; r<3; r++) {
+		for (int c=0; c<3; c++)
+			src.linear ()(r,c) = blk->rot[r][c];
+	}
+	src.prerotate (Eigen::AngleAxisd (blk->ang.z, Eigen::Vector3d::UnitZ ()));
+	src.pretranslate (Eigen::Vector3d (blk->shv.x, blk->shv.y, blk->shv.z));
 
-            if (!onefrm->dsv[i].points[j].x)
-				continue;
+	return (frmTarInv * src * frmCalib).matrix ().topRows<3> ().cast<float> ();
+}
 
-			rotatePoint3fi(onefrm->dsv[i].points[j], calibInfo.rot);
-			shiftPoint3fi(onefrm->dsv[i].points[j], calibInfo.shv); 
-			rotatePoint3fi(onefrm->dsv[i].points[j], onefrm->dsv[i].rot);
-
-			//rot1: R_tar^{-1}*R_src
-			rot1[0][0] = cos (onefrm->dsv[i].ang.z-onefrm->dsv[0].ang.z);
-			rot1[0][1] = -sin (onefrm->dsv[i].ang.z-onefrm->dsv[0].ang.z);
-			rot1[1][0] = sin (onefrm->dsv[i].ang.z-onefrm->dsv[0].ang.z);
-			rot1[1][1] = cos (onefrm->dsv[i].ang.z-onefrm->dsv[0].ang.z);
-
-			//shv: SHV_src-SHV_tar
-			point2d shv;
-            shv.x = onefrm->dsv[i].shv.x-onefrm->dsv[0].shv.x;
-            shv.y = onefrm->dsv[i].shv.y-onefrm->dsv[0].shv.y;
-
-			point2d pp;
-			pp.x = onefrm->dsv[i].points[j].x; pp.y = onefrm->dsv[i].points[j].y;
-			rotatePoint2d (pp, rot1);	//R_tar^{-1}*R_src*p
-			rotatePoint2d (shv, rot2);	//R_tar^{-1}*(SHV_src-SHV_tar)
-			shiftPoint2d (pp, shv);		//p'=R_tar^{-1}*R_src*p+R_tar^{-1}*(SHV_src-SHV_tar)
-			onefrm->dsv[i].points[j].x = pp.x;
-			onefrm->dsv[i].points[j].y = pp.y;
+void CorrectPoints ()
+{
+	//transform points of every block to the leveled vehicle frame of onefrm->dsv[0]
+	//one affine per block, blocks are independent
+#pragma omp parallel for schedule(static)
+	for (int i=0; i<BKNUM_PER_FRM; i++) {
+		ONEDSVDATA *blk = &onefrm->dsv[i];
+
+		const Eigen::Matrix<float, 3, 4> m = BlockTransform (i);
+		const float r00 = m(0,0), r01 = m(0,1), r02 = m(0,2), t0 = m(0,3);
+		const float r10 = m(1,0), r11 = m(1,1), r12 = m(1,2), t1 = m(1,3);
+		const float r20 = m(2,0), r21 = m(2,1), r22 = m(2,2), t2 = m(2,3);
+
+		//branch free, so the loop vectorizes: invalid points (x == 0) are blended back unchanged,
+		//the validity test is done on the bits since a float compare may trap and is not if-converted
+		point3fi *pts = blk->points;
+#pragma omp simd
+		for (int j=0; j<PTNUM_PER_BLK; j++) {
+			const float x = pts[j].x, y = pts[j].y, z = pts[j].z;
+			uint32_t xbits;
+			memcpy (&xbits, &x, sizeof (xbits));
+			const float valid = (xbits << 1) ? 1.f : 0.f;
+			pts[j].x = x + valid * (r00*x + r01*y + r02*z + t0 - x);
+			pts[j].y = y + valid * (r10*x + r11*y + r12*z + t1 - y);
+			pts[j].z = z + valid * (r20*x + r21*y + r22*z + t2 - z);
 		}
 	}
 
@@ -196,6 +266,11 @@ void ProcessOneFrame ()
 
 	CorrectPoints ();
 
+#ifndef STREAMING_FEATURES
+    /* ScanRegistration, before SmoothingData fills the range view with interpolated points */
+    ExtractFeatures ();
+#endif
+
 	SmoothingData ();
 
 	memset (rm.regionID, 0, sizeof(int)*rm.wid*rm.len);
@@ -246,7 +321,7 @@ void ConvertPointCloudType ()
                     continue;
                 pcl::PointXYZI single_laserCloudIn;
 //                single_laserCloudIn.x = p->y; single_laserCloudIn.y = p->z; single_laserCloudIn.z = p->x; single_laserCloudIn.intensity = 1.;
-                single_laserCloudIn.x = p->x; single_laserCloudIn.y = p->y; single_laserCloudIn.z = p->z; single_laserCloudIn.intensity = 1.;
+                single_laserCloudIn.x = p->x; single_laserCloudIn.y = p->y; single_laserCloudIn.z = p->z; single_laserCloudIn.intensity = p->i;
                 laserCloudIn->push_back(single_laserCloudIn);
             }
         }
@@ -259,14 +334,14 @@ void visualizeMap ()
 {
 #ifdef VIEW_MAP
     map_viewer.setBackgroundColor(0, 0, 0);
-    pcl::visualization::PointCloudColorHandlerGenericField<pcl::PointXYZI> handler(laserCloudMap,"z");
+    pcl::visualization::PointCloudColorHandlerGenericField<loam::PointXYZIRT> handler(laserCloudMap,"z");
     if(is_first_visualization_map)
     {
-        map_viewer.addPointCloud<pcl::PointXYZI>(laserCloudMap, handler, "Map");
+        map_viewer.addPointCloud<loam::PointXYZIRT>(laserCloudMap, handler, "Map");
     }
     else
     {
-        map_viewer.updatePointCloud<pcl::PointXYZI>(laserCloudMap, handler, "Map");
+        map_viewer.updatePointCloud<loam::PointXYZIRT>(laserCloudMap, handler, "Map");
     }
     is_first_visualization_map = false;
     map_viewer.setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "Map");
@@ -281,20 +356,20 @@ void visualizePointCloud ()
 {
 #ifndef VIEW_MAP
     viewer.setBackgroundColor(0, 0, 0);
-    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> red(cornerPointsSharp.makeShared(), 255, 9, 0);
-    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> green(surfPointsFlat.makeShared(), 0, 255, 0);
-    pcl::visualization::PointCloudColorHandlerGenericField<pcl::PointXYZI> handler(surfPointsLessFlat.makeShared(),"intensity");
+    pcl::visualization::PointCloudColorHandlerCustom<loam::PointXYZIRT> red(cornerPointsSharp.makeShared(), 255, 9, 0);
+    pcl::visualization::PointCloudColorHandlerCustom<loam::PointXYZIRT> green(surfPointsFlat.makeShared(), 0, 255, 0);
+    pcl::visualization::PointCloudColorHandlerGenericField<loam::PointXYZIRT> handler(surfPointsLessFlat.makeShared(),"ring");
     if(is_first_visualization)
     {
-        viewer.addPointCloud<pcl::PointXYZI>(surfPointsLessFlat.makeShared(), handler, "Point Cloud");
-        viewer.addPointCloud<pcl::PointXYZI>(cornerPointsSharp.makeShared(), red, "CornerPointSharp");
-        viewer.addPointCloud<pcl::PointXYZI>(surfPointsFlat.makeShared(), green, "surfPointsFlat");
+        viewer.addPointCloud<loam::PointXYZIRT>(surfPointsLessFlat.makeShared(), handler, "Point Cloud");
+        viewer.addPointCloud<loam::PointXYZIRT>(cornerPointsSharp.makeShared(), red, "CornerPointSharp");
+        viewer.addPointCloud<loam::PointXYZIRT>(surfPointsFlat.makeShared(), green, "surfPointsFlat");
     }
     else
     {
-        viewer.updatePointCloud<pcl::PointXYZI>(surfPointsLessFlat.makeShared(), handler, "Point Cloud");
-        viewer.updatePointCloud<pcl::PointXYZI>(cornerPointsSharp.makeShared(), red, "CornerPointSharp");
-        viewer.updatePointCloud<pcl::PointXYZI>(surfPointsFlat.makeShared(), green, "surfPointsFlat");
+        viewer.updatePointCloud<loam::PointXYZIRT>(surfPointsLessFlat.makeShared(), handler, "Point Cloud");
+        viewer.updatePointCloud<loam::PointXYZIRT>(cornerPointsSharp.makeShared(), red, "CornerPointSharp");
+        viewer.updatePointCloud<loam::PointXYZIRT>(surfPointsFlat.makeShared(), green, "surfPointsFlat");
     }
     is_first_visualization = false;
     viewer.setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "Point Cloud");
@@ -306,11 +381,74 @@ void visualizePointCloud ()
 #endif
 }
 
+#ifdef RANGE_IMAGE_FEATURES
+void GenerateRingImage ()
+{
+    /* the ring of a point is the rank of its beam by mean elevation, the beam index is not ordered by elevation */
+    double elevation[BEAMS_PER_FIRING] = {0};
+    int count[BEAMS_PER_FIRING] = {0};
+    for (int i=0; i<BKNUM_PER_FRM; i++) {
+        for (int j=0; j<PTNUM_PER_BLK; j++) {
+            point3fi *p = &onefrm->dsv[i].points[j];
+            if (!p->x)
+                continue;
+            const int beam = (j/PNTS_PER_LINE)%2*PNTS_PER_LINE + j%PNTS_PER_LINE;
+            elevation[beam] += atan2 (p->z-2.6, sqrt(sqr(p->x)+sqr(p->y)));
+            count[beam]++;
+        }
+    }
+    int beams[BEAMS_PER_FIRING], ringOfBeam[BEAMS_PER_FIRING];
+    for (int b=0; b<BEAMS_PER_FIRING; b++) {
+        beams[b] = b;
+        elevation[b] = count[b] ? elevation[b]/count[b] : HUGE_VAL;
+    }
+    std::stable_sort (beams, beams+BEAMS_PER_FIRING, [&elevation](int a, int b) { return elevation[a] < elevation[b]; });
+    for (int r=0; r<BEAMS_PER_FIRING; r++)
+        ringOfBeam[beams[r]] = r;
+
+    memset (ringImage, 0, sizeof (ringImage));
+    for (int i=0; i<BKNUM_PER_FRM; i++) {
+        const float relTime = (onefrm->dsv[i].millisec-onefrm->dsv[0].millisec)/1000.0f;
+        for (int j=0; j<PTNUM_PER_BLK; j++) {
+            point3fi *p = &onefrm->dsv[i].points[j];
+            if (!p->x)
+                continue;
+            const int beam = (j/PNTS_PER_LINE)%2*PNTS_PER_LINE + j%PNTS_PER_LINE;
+            const int idx = ringOfBeam[beam]*FIRINGS_PER_FRM + i*LINES_PER_BLK/2 + j/PNTS_PER_LINE/2;
+            ringImage[idx] = *p;
+            ringRelTime[idx] = relTime;
+        }
+    }
+}
+#endif
+
 void ExtractFeatures ()
 {
+#if defined(STREAMING_FEATURES)
+    /* features were extracted by ExtractSector while the frame was read */
+#elif defined(RANGE_IMAGE_FEATURES)
+    /* extract features on the corrected points organized by beam and firing, so every row is one scan ring */
+    GenerateRingImage ();
+    loam::RangeImage rangeImage;
+    rangeImage.data = &ringImage[0].x;
+    rangeImage.rows = BEAMS_PER_FIRING;
+    rangeImage.cols = FIRINGS_PER_FRM;
+    rangeImage.colStride = sizeof(point3fi) / sizeof(float);
+    rangeImage.rowStride = rangeImage.colStride * FIRINGS_PER_FRM;
+    rangeImage.rowStep = 1;
+    rangeImage.zOffset = -2.6;
+    rangeImage.intensity = &ringImage[0].i;
+    rangeImage.relTime = ringRelTime;
+    pointcloudTime = onefrm->dsv[0].millisec;
+    auto start = std::chrono::steady_clock::now();
+    multiScan.processRangeImage(pointcloudTime, rangeImage, cornerPointsSharp, cornerPointsLessSharp, surfPointsLessFlat, surfPointsFlat);
+    AddLoamTime(start);
+#else
     ConvertPointCloudType();
-    loam::MultiScanRegistration multiScan;
+    auto start = std::chrono::steady_clock::now();
     multiScan.process(laserCloudIn, pointcloudTime, cornerPointsSharp, cornerPointsLessSharp, surfPointsLessFlat, surfPointsFlat);
+    AddLoamTime(start);
+#endif
 
     std::cout << "cornerPointsSharp.size = " << cornerPointsSharp.points.size() << std::endl;
     std::cout << "surfPointsFlat.size = " << surfPointsFlat.points.size() << std::endl;
@@ -318,18 +456,121 @@ void ExtractFeatures ()
     visualizePointCloud();
 }
 
+#ifdef LIVE_NAV
+/* wait until the reader thread published a pose after the given time (or the NAV file ended), then drop the poses
+   older than the last one before it and hand the poses up to NAV_WINDOW after it to LOAM; the history stays in the
+   ring, nav only holds the window of the current scan */
+void ReceiveNav (long long time)
+{
+    const auto stampOf = [](const NAVDATA& data) { return data.millisec; };
+    for (;;) {
+        const bool done = navDone.load();   /* every pose is published once the reader is done */
+        size_t after = navQueue.lowerBound(time + 1, stampOf);
+        /* interpolation at the scan time needs the pose before it, scan times only increase; dropping the older
+           poses while waiting also makes room for the reader when the ring is full */
+        if (after > 1) {
+            navQueue.pop(after - 1);
+            after = 1;
+        }
+        if ((after < navQueue.size() && navQueue[after].millisec > time) || done) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+
+    const size_t end = std::min(navQueue.lowerBound(time + NAV_WINDOW + 1, stampOf) + 1, navQueue.size());
+    nav.resize(end);
+    for (size_t i = 0; i < end; i++) {
+        nav[i] = navQueue[i];
+    }
+}
+#endif
+
 void LaserOdometry ()
 {
+#ifdef LIVE_NAV
+    ReceiveNav(pointcloudTime);
+#endif
+    auto start = std::chrono::steady_clock::now();
     laserOdom.process(nav, pointcloudTime, cornerPointsSharp, cornerPointsLessSharp, surfPointsLessFlat, surfPointsFlat);
+    AddLoamTime(start);
 }
 
 void LaserMapping ()
 {
+    auto start = std::chrono::steady_clock::now();
     laserMapping.process(surfPointsLessFlat.makeShared(), cornerPointsSharp, surfPointsFlat, pointcloudTime, nav, laserCloudMap);
+    AddLoamTime(start);
+
+    /* mapping is the last LOAM stage of a frame, the new feature limits apply from the next frame on */
+    if (featureBudget.update(loamFrameTime)) {
+        multiScan.configure(featureBudget.params());
+    }
+#ifdef LOAM_PRINT_STATS
+    std::cout << "LOAM frame time -> " << loamFrameTime << " ms (mean " << featureBudget.meanTime()
+              << " ms), feature budget scale -> " << featureBudget.scale() << std::endl;
+#endif
+    loamFrameTime = 0;
 
     visualizeMap();
 }
 
+#ifdef STREAMING_FEATURES
+pcl::PointCloud<loam::PointXYZIRT> sectorCloud;
+pcl::PointCloud<loam::PointXYZIRT> sectorCornerPointsSharp, sectorCornerPointsLessSharp, sectorSurfPointsFlat, sectorSurfPointsLessFlat;
+
+void ExtractSector (int begin, int end)
+{
+    if (begin == 0) {
+        pointcloudTime = onefrm->dsv[0].millisec;
+        multiScan.beginSweep(pointcloudTime, SECTORS_PER_FRM);
+        cornerPointsSharp.clear();
+        cornerPointsLessSharp.clear();
+        surfPointsFlat.clear();
+        surfPointsLessFlat.clear();
+    }
+
+    /* correct the sector blocks like CorrectPoints, but into a copy, the DEM branch still needs the raw frame */
+    sectorCloud.clear();
+    for (int i=begin; i<end; i++) {
+        const Eigen::Matrix<float, 3, 4> m = BlockTransform (i);
+        const float relTime = (onefrm->dsv[i].millisec-onefrm->dsv[0].millisec)/1000.0f;
+        for (int j=0; j<PTNUM_PER_BLK; j++) {
+            point3fi *p = &onefrm->dsv[i].points[j];
+            if (!p->x)
+                continue;
+            loam::PointXYZIRT point;
+            point.x = m(0,0)*p->x + m(0,1)*p->y + m(0,2)*p->z + m(0,3);
+            point.y = m(1,0)*p->x + m(1,1)*p->y + m(1,2)*p->z + m(1,3);
+            point.z = m(2,0)*p->x + m(2,1)*p->y + m(2,2)*p->z + m(2,3);
+            point.intensity = p->i;
+            point.relTime = relTime;
+            point.ring = 0;
+            sectorCloud.push_back(point);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    multiScan.processSector(sectorCloud, sectorCornerPointsSharp, sectorCornerPointsLessSharp, sectorSurfPointsLessFlat, sectorSurfPointsFlat);
+    AddLoamTime(start);
+    cornerPointsSharp += sectorCornerPointsSharp;
+    cornerPointsLessSharp += sectorCornerPointsLessSharp;
+    surfPointsFlat += sectorSurfPointsFlat;
+    surfPointsLessFlat += sectorSurfPointsLessFlat;
+
+    /* the ring ends held back for the next sector are extracted once the sweep is complete */
+    if (end == BKNUM_PER_FRM) {
+        start = std::chrono::steady_clock::now();
+        multiScan.endSweep(sectorCornerPointsSharp, sectorCornerPointsLessSharp, sectorSurfPointsLessFlat, sectorSurfPointsFlat);
+        AddLoamTime(start);
+        cornerPointsSharp += sectorCornerPointsSharp;
+        cornerPointsLessSharp += sectorCornerPointsLessSharp;
+        surfPointsFlat += sectorSurfPointsFlat;
+        surfPointsLessFlat += sectorSurfPointsLessFlat;
+    }
+}
+#endif
+
 BOOL ReadOneDsvFrame ()
 {
 	DWORD	dwReadBytes;
@@ -341,6 +582,8 @@ BOOL ReadOneDsvFrame ()
 			break;
         }
         createRotMatrix_ZYX(onefrm->dsv[i].rot, onefrm->dsv[i].ang.x, onefrm->dsv[i].ang.y , 0 ) ;
+        if (i == 0)
+            PrepareBlockTransforms ();
 
         for (int j=0; j<LINES_PER_BLK; j++) {
             for (int k=0; k<PNTS_PER_LINE; k++) {
@@ -351,6 +594,11 @@ BOOL ReadOneDsvFrame ()
                 }
             }
         }
+#ifdef STREAMING_FEATURES
+        const int sectorBlks = (BKNUM_PER_FRM + SECTORS_PER_FRM - 1) / SECTORS_PER_FRM;
+        if ((i+1)%sectorBlks == 0 || i == BKNUM_PER_FRM-1)
+            ExtractSector (i/sectorBlks*sectorBlks, i+1);
+#endif
     }
     if (camCalibFlag) {
         memcpy(originFrm, onefrm, sizeof(*onefrm));
@@ -419,11 +667,22 @@ void LoadNav()
 //        float x, y, z, _roll, _pitch, _yaw;
 //        pcl::getTranslationAndEulerAngles(init,x,y,z,_roll,_pitch,_yaw);
 //        std::cout << "nav -> " << x << ", " << y << ", " << z << ", " << roll << ", " << pitch << ", " << yaw << std::endl;
+#ifdef LIVE_NAV
+        while (!navQueue.push((NAVDATA){millisec, gx, gy, gz, roll, pitch, yaw, stat}) && !navStop.load())
+            std::this_thread::yield();
+        if (navStop.load())
+            break;
+#else
         nav.push_back((NAVDATA){millisec, gx, gy, gz, roll, pitch, yaw, stat});
+#endif
     }
     navLeft = 0;
     navRight = 0;
+#ifdef LIVE_NAV
+    navDone.store(true);
+#else
     printf("size of NAV: %d\n", int(nav.size()));
+#endif
 }
 
 void DoProcessingOffline(/*P_CGQHDL64E_INFO_MSG *veloData, P_DWDX_INFO_MSG *dwdxData, P_CJDEMMAP_MSG &demMap, P_CJATTRIBUTEMAP_MSG &attributeMap*/)
@@ -443,7 +702,11 @@ void DoProcessingOffline(/*P_CGQHDL64E_INFO_MSG *veloData, P_DWDX_INFO_MSG *dwdx
         getchar ();
         exit (1);
     }
+#ifdef LIVE_NAV
+    navThread = std::thread(LoadNav);
+#else
     LoadNav();
+#endif
 
     LONGLONG fileSize = myGetFileSize(dfp);
     dFrmNum = fileSize / (BKNUM_PER_FRM) / dsbytesiz;
@@ -471,6 +734,15 @@ void DoProcessingOffline(/*P_CGQHDL64E_INFO_MSG *veloData, P_DWDX_INFO_MSG *dwdx
 
 		printf("%d (%d)\n",dFrmNo,dFrmNum);
 
+#ifdef STREAMING_FEATURES
+        /* the features are complete once the last block is read, run the LOAM branch before the DEM branch */
+        ExtractFeatures();
+
+        LaserOdometry();
+
+        LaserMapping();
+#endif
+
         ProcessOneFrame ();
 
         DrawTraj(dm.lmap);
@@ -484,12 +756,11 @@ void DoProcessingOffline(/*P_CGQHDL64E_INFO_MSG *veloData, P_DWDX_INFO_MSG *dwdx
             cv::imshow("l_dem",visImg);
         }
 
-        /* ScanRegistration */
-        ExtractFeatures();
-
+#ifndef STREAMING_FEATURES
         LaserOdometry();
 
         LaserMapping();
+#endif
 
 		char WaitKey;
 		WaitKey = cvWaitKey(waitkeydelay);
@@ -505,6 +776,10 @@ void DoProcessingOffline(/*P_CGQHDL64E_INFO_MSG *veloData, P_DWDX_INFO_MSG *dwdx
 	ReleaseDmap (&ggm);
 	cvReleaseImage(&col);
     delete []onefrm;
+#ifdef LIVE_NAV
+    navStop.store(true);
+    navThread.join();
+#endif
 }
 
 int main (int argc, char *argv[])
@@ -520,8 +795,37 @@ int main (int argc, char *argv[])
 //        exit(1);
 //    }
 
+#ifdef PROJECTIVE_ODOMETRY
+    laserOdom.setCorrespondenceMode(loam::BasicLaserOdometry::PROJECTIVE_CORRESPONDENCE);
+#endif
+#ifdef LOAM_SOLVER_BUDGET
+    laserOdom.setTimeBudget(LOAM_SOLVER_BUDGET);
+    laserMapping.setTimeBudget(LOAM_SOLVER_BUDGET);
+#endif
+#ifdef MAP_TILE_DIR
+    laserMapping.setMaxCubes(MAP_MAX_CUBES);
+    laserMapping.setTileDirectory(MAP_TILE_DIR);
+#endif
+#ifdef MAP_FILE
+    const bool mapLoaded = access(MAP_FILE, R_OK) == 0 && laserMapping.loadMap(MAP_FILE);
+#ifdef LOCALIZATION_ONLY
+    /* localize only against a loaded map, without one the map is built as usual (but not saved) */
+    if (mapLoaded) {
+        laserMapping.setLocalizationMode(true);
+    } else {
+        std::cerr << "no map loaded from " << MAP_FILE << ", building a new map" << std::endl;
+    }
+#else
+    (void)mapLoaded;
+#endif
+#endif
+
     DoProcessingOffline ();
 
+#if defined(MAP_FILE) && !defined(LOCALIZATION_ONLY)
+    laserMapping.saveMap(MAP_FILE);
+#endif
+
     printf ("Done.\n");
 
     fclose(dfp);